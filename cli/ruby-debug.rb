@@ -4,6 +4,7 @@ require 'socket'
 require 'thread'
 require 'ruby-debug-base'
 require_relative 'ruby-debug/processor'
+require_relative 'ruby-debug/event_stream'
 
 module Debugger
   self.handler = CommandProcessor.new
@@ -11,6 +12,9 @@ module Debugger
   # the port number used for remote debugging
   PORT = 8989 unless defined?(PORT)
 
+  # seconds a remote session is given to announce the framed protocol
+  HANDSHAKE_TIMEOUT = 0.5 unless defined?(HANDSHAKE_TIMEOUT)
+
   # What file is used for debugger startup commands.
   unless defined?(INITFILE)
     if RUBY_PLATFORM =~ /mswin/
@@ -35,7 +39,16 @@ module Debugger
     # if the call stack is truncated.
     attr_accessor :start_sentinal 
     
-    attr_reader :thread, :control_thread
+    attr_reader :thread, :control_thread, :event_stream
+
+    # Protocol spoken on the remote ports: :text (the default),
+    # :framed, or :auto to use whichever the client announces. See
+    # FramedProtocol.
+    attr_writer :protocol
+
+    def protocol
+      @protocol || :text
+    end
 
     def interface=(value) # :nodoc:
       handler.interface = value
@@ -66,7 +79,9 @@ module Debugger
       @thread = DebugThread.new do
         server = TCPServer.new(host, cmd_port)
         while (session = server.accept)
-          self.interface = RemoteInterface.new(session)
+          interface = remote_interface(session)
+          next unless interface
+          self.interface = interface
           if wait_connection
             mutex.synchronize do
               proceed.signal
@@ -87,7 +102,8 @@ module Debugger
       @control_thread = DebugThread.new do
         server = TCPServer.new(host, ctrl_port)
         while (session = server.accept)
-          interface = RemoteInterface.new(session)
+          interface = remote_interface(session)
+          next unless interface
           processor = ControlCommandProcessor.new(interface)
           processor.process_commands
         end
@@ -95,14 +111,59 @@ module Debugger
     end
     
     #
-    # Connects to the remote debugger
+    # Starts sending debugger events to clients connecting on +port+.
+    # See EventStream.
     #
-    def start_client(host = 'localhost', port = PORT)
+    def start_events(host = nil, port = PORT + 2,
+                     buffer_size = EventStream::DEFAULT_BUFFER_SIZE)
+      return @event_stream if @event_stream
+      @event_stream = EventStream.new(buffer_size).start(host, port)
+    end
+
+    # Queue an event for the clients of the event stream, if any.
+    def publish_event(type, fields = {}) # :nodoc:
+      @event_stream.publish(type, fields) if @event_stream
+    end
+
+    # Wraps an accepted +session+ in an interface for the protocol the
+    # client wants. A framed client sends FramedProtocol::MAGIC first.
+    # In :auto mode any other client gets the text protocol, as soon as
+    # it sends something else or after a short wait; in :framed mode it
+    # is dropped.
+    def remote_interface(session) # :nodoc:
+      framed = case protocol
+               when :framed
+                 FramedProtocol.handshake?(session, HANDSHAKE_TIMEOUT) or
+                   raise IOError, 'no framed protocol handshake'
+               when :auto then FramedProtocol.handshake?(session, HANDSHAKE_TIMEOUT)
+               else false
+               end
+      framed ? FramedInterface.new(session) : RemoteInterface.new(session)
+    rescue IOError, SystemCallError
+      session.close rescue nil
+      nil
+    end
+
+    #
+    # Connects to the remote debugger. +protocol+ is :text or :framed.
+    #
+    def start_client(host = 'localhost', port = PORT, protocol = :text)
       require "socket"
       interface = Debugger::LocalInterface.new
       socket = TCPSocket.new(host, port)
       puts "Connected."
       
+      if protocol == :framed
+        framed_client(socket, interface)
+      else
+        text_client(socket, interface)
+      end
+      socket.close
+    end
+
+    private
+
+    def text_client(socket, interface)
       catch(:exit) do
         while (line = socket.gets)
           case line 
@@ -119,7 +180,55 @@ module Debugger
           end
         end
       end
-      socket.close
+    end
+
+    def framed_client(socket, interface)
+      socket.write(FramedProtocol::MAGIC)
+      request_id = 0
+      while (frame = FramedProtocol.read(socket))
+        type, id, payload = frame
+        case type
+        when FramedProtocol::PROMPT
+          input = interface.read_command(payload)
+          break unless input
+          FramedProtocol.write(socket, FramedProtocol::COMMAND,
+                               request_id += 1, input)
+        when FramedProtocol::CONFIRM
+          input = interface.confirm(payload)
+          break unless input
+          FramedProtocol.write(socket, FramedProtocol::REPLY, id, input)
+        when FramedProtocol::OUTPUT
+          print payload
+        when FramedProtocol::ERROR
+          print "*** ", payload
+        end
+      end
+    end
+
+    public
+
+    #
+    # Opens a core file written by Debugger.write_core and runs the
+    # command loop on the frames it recorded. Only commands that look
+    # at frames and source ("where", "frame", "info locals", "list")
+    # are useful; nothing can be evaluated or resumed.
+    #
+    def open_core(path)
+      core = CoreFile.read(path)
+      if core.stack_size == 0
+        print "Core file #{path} has no frames.\n"
+        return
+      end
+      printf "Core file of %s (pid %d) written %s\n", core.program, core.pid,
+        Time.at(core.time)
+      unless core.exception_class.empty?
+        Debugger.last_exception = CoreFile::Value.new("#<%s: %s>" %
+          [core.exception_class, core.exception_message])
+      end
+      # Only rendered strings were saved for values, so the class of an
+      # argument can't be shown.
+      Command.settings[:callstyle] = :short
+      handler.at_line(core, core.frame_file(0), core.frame_line(0))
     end
     
     # Runs normal debugger initialization scripts
@@ -19,6 +19,11 @@ module Debugger
       else
         _, file, line, expr = @match.captures
       end
+      threads = nil
+      if expr && expr =~ /^\s*thread\s+(\d+(?:\s*,\s*\d+)*)\s*(.*)$/
+        threads = $1.split(/\s*,\s*/).map{|n| n.to_i}
+        expr = $2.empty? ? nil : $2
+      end
       if expr 
         if expr !~ /^\s*if\s+(.+)/
           if file or line
@@ -81,8 +86,14 @@ module Debugger
           errmsg "We are not in a state we can add breakpoints.\n"
           return 
         end
-        b = Debugger.add_breakpoint brkpt_filename, line, expr
-        print "Breakpoint %d file %s, line %s\n", b.id, brkpt_filename, line.to_s
+        begin
+          b = Debugger.add_breakpoint brkpt_filename, line, expr
+        rescue ArgumentError => e
+          errmsg "#{e.message}\n"
+          return
+        end
+        b.threads = threads
+        print "Breakpoint %d file %s, line %s\n", b.id, brkpt_filename, b.pos.to_s
         unless syntax_valid?(expr)
           errmsg("Expression \"#{expr}\" syntactically incorrect; breakpoint disabled.\n")
           b.enabled = false
@@ -90,6 +101,7 @@ module Debugger
       else
         method = line.intern.id2name
         b = Debugger.add_breakpoint class_name, method, expr
+        b.threads = threads
         print "Breakpoint %d at %s::%s\n", b.id, class_name, method.to_s
       end
     end
@@ -101,9 +113,131 @@ module Debugger
 
       def help(cmd)
         %{
-          b[reak] file:line [if expr]
-          b[reak] class(.|#)method [if expr]
-          \tset breakpoint to some position, (optionally) if expr == true
+          b[reak] file:line [thread n[,n...]] [if expr]
+          b[reak] class(.|#)method [thread n[,n...]] [if expr]
+          \tset breakpoint to some position, (optionally) if expr == true.
+          \tWith thread, only the threads with those numbers (see "info
+          \tthreads") stop there.
+        }
+      end
+    end
+  end
+
+  # Implements debugger "logpoint" command.
+  class AddLogpoint < Command
+    self.allow_in_control = true
+
+    def regexp
+      /^\s*logpoint\s+(.+?):(\d+)\s+(.+?)\s*$/
+    end
+
+    def execute
+      file, line, format = @match.captures
+      file = File.expand_path(file) if file.index(File::SEPARATOR)
+      begin
+        b = Debugger.add_logpoint(file, line.to_i, format)
+      rescue ArgumentError => e
+        errmsg "#{e.message}\n"
+        return
+      end
+      print "Logpoint %d file %s, line %s\n", b.id, file, b.pos.to_s
+    end
+
+    class << self
+      def help_command
+        'logpoint'
+      end
+
+      def help(cmd)
+        %{
+          logpoint file:line format
+          \tlog a message each time line is reached, without stopping.
+          \t{name} in format is replaced by the value of local variable
+          \tname, {@name} by an instance variable and {self} by self.
+          \tMessages go to Debugger.log_file, standard error by default.
+        }
+      end
+    end
+  end
+
+  # Implements debugger "snapshot" command.
+  class AddSnapshot < Command
+    self.allow_in_control = true
+
+    def regexp
+      /^\s*snapshot\s+(.+?):(\d+)((?:\s+(?:depth|bytes|count)\s+\d+)*)\s*$/
+    end
+
+    def execute
+      file, line, limits = @match.captures
+      file = File.expand_path(file) if file.index(File::SEPARATOR)
+      options = {}
+      limits.scan(/(depth|bytes|count)\s+(\d+)/) do |name, value|
+        name = 'max_' + name unless name == 'count'
+        options[name.to_sym] = value.to_i
+      end
+      begin
+        b = Debugger.add_snapshot(file, line.to_i, options)
+      rescue ArgumentError => e
+        errmsg "#{e.message}\n"
+        return
+      end
+      print "Snapshot point %d file %s, line %s\n", b.id, file, b.pos.to_s
+    end
+
+    class << self
+      def help_command
+        'snapshot'
+      end
+
+      def help(cmd)
+        %{
+          snapshot file:line [depth n] [bytes n] [count n]
+          \trecord the backtrace and local variables each time line is
+          \treached, without stopping. depth is the number of frames
+          \tkept (20), bytes the size of a snapshot (16384) and count
+          \tthe number of snapshots taken before the point disables
+          \titself (1). See "snapshots" to read them.
+        }
+      end
+    end
+  end
+
+  # Implements debugger "snapshots" command.
+  class ShowSnapshots < Command
+    self.allow_in_control = true
+
+    def regexp
+      /^\s*snapshots(?:\s+(clear))?\s*$/
+    end
+
+    def execute
+      if @match[1]
+        Debugger.clear_snapshots
+        return
+      end
+      snapshots = Debugger.snapshots
+      if snapshots.empty?
+        print "No snapshots.\n"
+        return
+      end
+      snapshots.each do |s|
+        print "Snapshot %d of point %d, thread %d at %s:%d, %s%s\n",
+        s[:id], s[:breakpoint], s[:thnum], s[:file], s[:line],
+        s[:time].strftime('%Y-%m-%d %H:%M:%S'),
+        s[:truncated] ? ' (truncated)' : ''
+        print "%s", s[:text]
+      end
+    end
+
+    class << self
+      def help_command
+        'snapshots'
+      end
+
+      def help(cmd)
+        %{
+          snapshots[ clear]\tshow or drop the snapshots taken
         }
       end
     end
@@ -16,7 +16,7 @@ module Debugger
       elsif not @match[2]
         # One arg given.
         if 'off' == excn
-          Debugger.catchpoints.clear if 
+          Debugger.clear_catchpoints if 
             confirm("Delete all catchpoints? (y or n) ")
         else
           binding = @state.context ? get_binding : TOPLEVEL_BINDING
@@ -28,8 +28,7 @@ module Debugger
         end
       elsif @match[2] != 'off'
         errmsg "Off expected. Got %s\n", @match[2]
-      elsif Debugger.catchpoints.member?(excn)
-        Debugger.catchpoints.delete(excn)
+      elsif Debugger.remove_catchpoint(excn)
         print "Catch for exception %s removed.\n", excn
       else
         errmsg "Catch for exception %s not found.\n", excn
@@ -8,15 +8,60 @@ module Debugger
       @state.display.select{|d| d[0]}.size > 0
     end
 
-    def print_display_expressions
-      n = 1
-      for d in @state.display
-        if d[0]
-          print "%d: ", n
-          display_expression(d[1])
-        end
-        n += 1
+    # Each entry of @state.display is [enabled, expression] followed by
+    # the compiled expression, the frame it was compiled for and the
+    # text last shown. An expression is compiled into a lambda once per
+    # frame and called at each stop instead of being parsed again.
+    def display_value(d)
+      frame = @state.context.frame_env_id(@state.frame_pos) rescue nil
+      unless frame and d[3] == frame
+        d[2] = begin
+                 eval("lambda { #{d[1]} }", get_binding)
+               rescue StandardError, ScriptError
+                 nil
+               end
+        d[3] = frame
+      end
+      return '' unless d[2]
+      begin
+        d[2].call.to_s
+      rescue StandardError, ScriptError
+        ''
+      end
+    end
+
+    # The text of each enabled display expression. The values are
+    # worked out once per stop and frame, and shared by the display
+    # command and the annotations, unless +refresh+ is given or the
+    # expressions change.
+    def display_values(refresh = false)
+      key = [@state.frame_pos, @state.display.map{|d| [d[0], d[1]]}]
+      cache = @state.display_cache
+      return cache[1] if cache and cache[0] == key and !refresh
+      values = []
+      @state.display.each_with_index do |d, i|
+        next unless d[0]
+        values << [i + 1, d[1], display_value(d)]
       end
+      @state.display_cache = [key, values]
+      values
+    end
+
+    def print_display_values(values)
+      for n, exp, value in values
+        print "%d: %s = %s\n", n, exp, value
+      end
+    end
+
+    # Shows the enabled display expressions. With +changed_only+, an
+    # expression is shown only if its value differs from the last time
+    # it was shown; otherwise the values are worked out again.
+    def print_display_expressions(changed_only = false)
+      values = display_values(!changed_only)
+      values = values.select{|n, exp, value| value != @state.display[n-1][4]} if
+        changed_only
+      values.each{|n, exp, value| @state.display[n-1][4] = value}
+      print_display_values(values)
     end
   end
 
@@ -59,8 +104,10 @@ module Debugger
       /^\s*disp(?:lay)?$/
     end
 
+    # Run at a stop (no match) only the expressions whose value
+    # changed are shown; the display command shows them all.
     def execute
-      print_display_expressions
+      print_display_expressions(@match.nil?)
     end
 
     class << self
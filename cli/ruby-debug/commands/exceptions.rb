@@ -0,0 +1,54 @@
+module Debugger
+
+  # Implements debugger "exceptions" command.
+  class ExceptionsCommand < Command
+    self.allow_in_control = true
+
+    def regexp
+      / ^\s*
+         exceptions
+         (?:\s+(start|stop))?
+         \s*$
+      /x
+    end
+
+    def execute
+      case @match[1]
+      when 'start'
+        Debugger.exception_profile_start
+        print "Counting exceptions.\n"
+      when 'stop'
+        Debugger.exception_profile_stop
+        print "Stopped counting exceptions.\n"
+      else
+        profile = Debugger.exception_profile
+        if profile.empty?
+          print "No exceptions counted.\n"
+          return
+        end
+        profile.each do |site|
+          print "%8d %s at %s:%d\n", site[:count], site[:class],
+          CommandProcessor.canonic_file(site[:file]), site[:line]
+        end
+      end
+    end
+
+    class << self
+      def help_command
+        'exceptions'
+      end
+
+      def help(cmd)
+        %{
+          exceptions start\tcount exceptions raised
+          exceptions stop\tstop counting them
+          exceptions\t\tlist the counts, by class and raising line
+
+          Counting doesn't change whether exceptions stop at catchpoints.
+          Without the debugger on, they cost little more than they
+          would with no debugger at all.
+        }
+      end
+    end
+  end
+end
@@ -38,6 +38,12 @@ Attributes include: "all", "basic", "breakpoint", "lines", "mtime", "path"
 and "sha1".'],
        ['files', 5, 'File names and timestamps of files read in'],
        ['global_variables', 2, 'Global variables'],
+       ['history', 2, 'Lines last executed by the current thread',
+'
+Shows what the flight recorder kept of the lines and calls the current
+thread executed before it stopped, the most recent last. Follow the
+command with a number to see only that many lines; the default is 10.
+See "set flight-recorder".'],
        ['instance_variables', 2, 
         'Instance variables of the current stack frame'],
        ['line', 2, 
@@ -142,13 +148,26 @@ item. If \'verbose\' is given then the entire stack frame is shown.'],
         end
         print "Num Enb What\n"
         brkpts.each do |b|
-          if b.expr.nil?
+          if b.action == :log
+            print "%3d %s   log at %s:%s %s\n",
+            b.id, (b.enabled? ? 'y' : 'n'), b.source, b.pos, b.format
+          elsif b.action == :snapshot
+            print "%3d %s   snapshot at %s:%s, %d left\n",
+            b.id, (b.enabled? ? 'y' : 'n'), b.source, b.pos, b.snapshots_left
+          elsif b.expr.nil?
             print "%3d %s   at %s:%s\n", 
             b.id, (b.enabled? ? 'y' : 'n'), b.source, b.pos
           else
             print "%3d %s   at %s:%s if %s\n", 
             b.id, (b.enabled? ? 'y' : 'n'), b.source, b.pos, b.expr
           end
+          if b.threads
+            print "\tonly in thread#{b.threads.size > 1 ? 's' : ''} %s\n",
+            b.threads.join(', ')
+          end
+          if b.sample > 1
+            print "\tsampled: looks at 1 hit in #{b.sample}\n"
+          end
           hits = b.hit_count
           if hits > 0
             s = (hits > 1) ? 's' : ''
@@ -248,6 +267,28 @@ item. If \'verbose\' is given then the entire stack frame is shown.'],
       end
     end
     
+    def info_history(*args)
+      unless @state.context
+        errmsg "info history not available here.\n"
+        return
+      end
+      count = get_int(args[0], "info history", 1, nil, 10)
+      return unless count
+      history = @state.context.history(count)
+      if history.empty?
+        print "No lines recorded. See \"set flight-recorder\".\n"
+        return
+      end
+      last = history[-1][:time]
+      depth = history.map{|h| h[:depth]}.min
+      for h in history
+        s = "%+.6fs %s%s:%d" % [h[:time] - last, '  ' * (h[:depth] - depth),
+                                CommandProcessor.canonic_file(h[:file]), h[:line]]
+        s << " call #{h[:method]}" if h[:event] == :call
+        print "#{s}\n"
+      end
+    end
+
     def info_instance_variables(*args)
       unless @state.context
         print "info instance_variables not available here.\n"
@@ -70,17 +70,17 @@ module Debugger
     # previous line @state.previous_line.
     def display_list(b, e, file, current)
       print "[%d, %d] in %s\n", b, e, file
-      lines = LineCache::getlines(file, 
-                                  Command.settings[:reload_source_on_change])
-      if lines
-        return @state.previous_line if b >= lines.size
-        e = lines.size if lines.size < e
+      size = Debugger.source_size(file)
+      if size
+        return @state.previous_line if b >= size
+        e = size if size < e
         [b, 1].max.upto(e) do |n|
-          if n > 0 && lines[n-1]
+          line = Debugger.source_line(file, n)
+          if line
             if n == current
-              print "=> %d  %s\n", n, lines[n-1].chomp
+              print "=> %d  %s\n", n, line.chomp
             else
-              print "   %d  %s\n", n, lines[n-1].chomp
+              print "   %d  %s\n", n, line.chomp
             end
           end
         end
@@ -88,7 +88,7 @@ module Debugger
         errmsg "No sourcefile available for %s\n", file
         return @state.previous_line
       end
-      return e == lines.size ? @state.previous_line : b
+      return e == size ? @state.previous_line : b
     end
   end
 end
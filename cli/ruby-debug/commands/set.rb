@@ -27,6 +27,10 @@ ruby-debug."],
         "Set how you want call parameters displayed"],
        ['debuggertesting', 8, false,
         "Used when testing the debugger"],
+       ['flight-recorder', 2, false,
+        "Set number of lines each thread's flight recorder keeps",
+"Each line and call executed is recorded, up to this number per thread;
+0 turns the recorder off. \"info history\" shows what was recorded."],
        ['forcestep', 2, true,
         "Make sure 'next/step' commands always move to a new line"],
        ['fullpath', 2, true,
@@ -42,8 +46,25 @@ set history size -- Set the size of the command history"],
        "Set line execution tracing"],
        ['listsize', 3, false,
        "Set number of source lines to list by default"],
+       ['skip-path', 2, false,
+        "Set path prefixes of code that step and breakpoints skip",
+"Follow this command with any number of file or directory names; with
+none, no code is skipped. Stepping passes over the lines of files under
+them, for example gems or the standard library, and breakpoints on those
+lines are ignored."],
        ['trace', 1, true,
         "Display stack trace when 'eval' raises exception"],
+       ['trace-filter', 7, false,
+        "Set which lines line tracing shows",
+"set trace-filter include GLOB... -- trace only files matching a GLOB
+set trace-filter exclude GLOB... -- don't trace files matching a GLOB
+set trace-filter methods PATTERN... -- trace only methods such as Foo#bar,
+  Foo.bar or Foo::*
+set trace-filter depth N -- trace at most N frames deeper than where
+  tracing started; 0 for no limit
+set trace-filter -- trace every line
+
+In a GLOB, * matches any characters, / included."],
        ['width', 1, false,
         "Number of characters the debugger thinks are in a line"],
       ].map do |name, min, is_bool, short_help, long_help| 
@@ -130,6 +151,10 @@ set history size -- Set the size of the command history"],
                 if set_on
                   Command.settings[:basename] = true
                 end
+              when /^flight-recorder$/
+                size = get_int(args[0], "Set flight-recorder", 0, nil, 1000)
+                return unless size
+                Debugger.flight_recorder = size > 0 ? size : nil
               when /^forcestep$/
                 self.class.settings[:force_stepping] = set_on
               when /^history$/
@@ -152,6 +177,28 @@ set history size -- Set the size of the command history"],
                 self.class.settings[:tracing_plus] = set_on
               when /^linetrace$/
                 Debugger.tracing = set_on
+              when /^skip-path$/
+                Debugger.skip_paths = args.map{|path| File.expand_path(path)}
+              when /^trace-filter$/
+                filter = Debugger.trace_filter || {}
+                case args.shift
+                when nil
+                  filter = nil
+                when 'include'
+                  filter[:include] = args
+                when 'exclude'
+                  filter[:exclude] = args
+                when 'methods'
+                  filter[:methods] = args
+                when 'depth'
+                  depth = get_int(args[0], "Set trace-filter depth", 0, nil, 0)
+                  return unless depth
+                  filter[:max_depth] = depth > 0 ? depth : nil
+                else
+                  print "Invalid trace-filter parameter. Should be 'include', 'exclude', 'methods' or 'depth'.\n"
+                  return
+                end
+                Debugger.trace_filter = filter
               when /^listsize$/
                 listsize = get_int(args[0], "Set listsize", 1, nil, 10)
                 if listsize
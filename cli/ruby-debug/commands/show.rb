@@ -74,6 +74,10 @@ module Debugger
       when /^debuggertesting$/
         on_off = Command.settings[:debuggertesting]
         return "Currently testing the debugger is #{show_onoff(on_off)}."
+      when /^flight-recorder$/
+        size = Debugger.flight_recorder
+        return "The flight recorder is off." unless size
+        return "The flight recorder keeps #{size} lines per thread."
       when /^forcestep$/
         on_off = self.class.settings[:force_stepping]
         return "force-stepping is #{show_onoff(on_off)}."
@@ -130,9 +134,21 @@ module Debugger
         return "Number of source lines to list by default is #{listlines}."
       when /^port$/
         return "server port is #{Debugger::PORT}."
+      when /^skip-path$/
+        paths = Debugger.skip_paths
+        return "No code is skipped." if paths.empty?
+        return "Code under #{paths.join(', ')} is skipped."
       when /^trace$/
         on_off = Command.settings[:stack_trace_on_error]
         return "Displaying stack trace is #{show_onoff(on_off)}."
+      when /^trace-filter$/
+        filter = Debugger.trace_filter
+        return "Every line is traced." unless filter
+        parts = [:include, :exclude, :methods].map do |key|
+          "#{key} #{filter[key].join(', ')}" unless filter[key].empty?
+        end
+        parts << "depth #{filter[:max_depth]}" if filter[:max_depth]
+        return "Lines traced: #{parts.compact.join('; ')}."
       when /^version$/
         return "ruby-debug #{Debugger::VERSION}"
       when /^width$/
@@ -162,6 +178,7 @@ ruby-debug."],
        ['callstyle', 2, "Show paramater style used showing call frames"],
        ['commands',  2, "Show the history of commands you typed",
 "You can supply a command number to start with."],
+       ['flight-recorder', 2, "Show number of lines each thread's flight recorder keeps"],
        ['forcestep', 1, "Show if sure 'next/step' forces move to a new line"],
        ['fullpath',  2, "Show if full file names are displayed in frames"],
        ['history', 2, "Generic command for showing command history parameters",
@@ -175,8 +192,10 @@ show history size -- Show the size of the command history"],
        ['listsize', 3, "Show number of source lines to list by default"],
        ['port', 3, "Show server port"],
        ['post-mortem', 3, "Show whether we go into post-mortem debugging on an uncaught exception"],
+       ['skip-path', 2, "Show path prefixes of code that step and breakpoints skip"],
        ['trace', 1, 
         "Show if a stack trace is displayed when 'eval' raises exception"],
+       ['trace-filter', 7, "Show which lines line tracing shows"],
        ['version', 1, 
         "Show what version of the debugger this is"],
        ['width', 1, 
@@ -0,0 +1,53 @@
+module Debugger
+
+  # Implements debugger "stats" command.
+  class StatsCommand < Command
+    self.allow_in_control = true
+
+    def regexp
+      / ^\s*
+         stats
+         (?:\s+budget\s+(off|\d+(?:\.\d+)?))?
+         \s*$
+      /x
+    end
+
+    def execute
+      budget = @match[1]
+      if budget
+        Debugger.cpu_budget = (budget == 'off') ? nil : budget.to_f / 100
+        return
+      end
+      stats = Debugger.stats
+      if stats[:cpu_budget]
+        print "CPU budget: %.2f%%, last second: %.2f%%\n",
+        stats[:cpu_budget] * 100, stats[:usage] * 100
+      else
+        print "No CPU budget.\n"
+      end
+      print "Time in the debugger: %.3fs over %d events\n",
+      stats[:hook_time], stats[:events]
+      stats[:degraded].each do |action|
+        print "Governor: %s\n", action
+      end
+    end
+
+    class << self
+      def help_command
+        'stats'
+      end
+
+      def help(cmd)
+        %{
+          stats\t\t\tshow how much CPU the debugger uses
+          stats budget PERCENT|off\tlimit it
+
+          With a budget, once the debugger uses more than PERCENT of a
+          CPU, the breakpoints whose conditions and actions cost the most
+          are made to look at only some of their hits and then disabled,
+          or tracing is turned off. "stats" lists what was done.
+        }
+      end
+    end
+  end
+end
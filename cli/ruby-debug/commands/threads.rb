@@ -3,7 +3,7 @@ module Debugger
     def display_context(c, show_top_frame=true)
       c_flag = c.thread == Thread.current ? '+' : ' '
       c_flag = '$' if c.suspended?
-      d_flag = c.ignored? ? '!' : ' '
+      d_flag = c.ignored? ? '!' : (c.debugging? ? ' ' : '-')
       print "%s%s", c_flag, d_flag
       print "%d ", c.thnum
       print "%s\t", c.thread.inspect
@@ -129,6 +129,48 @@ module Debugger
     end
   end
 
+  class ThreadDebuggingCommand < Command # :nodoc:
+    self.allow_in_post_mortem = false
+    self.allow_in_control = true
+
+    def regexp
+      /^\s*th(?:read)?\s+debugging\s+(\S+)\s+(on|off)\s*$/
+    end
+
+    def execute
+      on = @match[2] == 'on'
+      if @match[1] == 'default'
+        Debugger.debugging_default = on
+        return
+      end
+      c = parse_thread_num("thread debugging", @match[1])
+      return unless c
+      if c.ignored?
+        errmsg "Thread #{@match[1]} is a debugger thread.\n"
+        return
+      end
+      c.debugging = on
+      display_context(c)
+    end
+
+    class << self
+      def help_command
+        'thread'
+      end
+
+      def help(cmd)
+        %{
+          th[read] debugging <nnn> on|off\tturn debugging of thread nnn on or off
+          th[read] debugging default on|off\tfor threads that start later
+
+          A thread with debugging off runs without the debugger's hook:
+          it doesn't stop at breakpoints and can't be stepped. "info
+          threads" marks it with '-'.
+        }
+      end
+    end
+  end
+
   # Thread switch Must come after "Thread resume" because "switch" is
   # optional
 
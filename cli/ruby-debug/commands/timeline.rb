@@ -0,0 +1,52 @@
+module Debugger
+
+  # Implements debugger "timeline" command.
+  class TimelineCommand < Command
+
+    def regexp
+      / ^\s*
+         timeline
+         (?:\s+(start|stop|dump)(?:\s+(.+?))?)?
+         \s*$
+      /x
+    end
+
+    def execute
+      case @match[1]
+      when 'start'
+        Debugger.timeline_start
+        print "Recording calls.\n"
+      when 'stop'
+        Debugger.timeline_stop
+        print "Stopped recording calls.\n"
+      when 'dump'
+        unless @match[2]
+          errmsg "\"timeline dump\" needs a file name.\n"
+          return
+        end
+        file = File.expand_path(@match[2])
+        Debugger.timeline_dump(file)
+        print "Timeline written to %s.\n", file
+      else
+        print "Usage: timeline start|stop|dump FILE\n"
+      end
+    end
+
+    class << self
+      def help_command
+        'timeline'
+      end
+
+      def help(cmd)
+        %{
+          timeline start\t\trecord calls and returns of every thread
+          timeline stop\t\tstop recording them
+          timeline dump FILE\twrite them to FILE as Chrome trace-event JSON
+
+          Load FILE in chrome://tracing or Perfetto to see each thread's
+          calls along a time line.
+        }
+      end
+    end
+  end
+end
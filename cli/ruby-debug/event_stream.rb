@@ -0,0 +1,140 @@
+require 'socket'
+require 'thread'
+require_relative 'protocol'
+
+module Debugger
+  # Pushes debugger events to clients connected on their own port, so a
+  # front end learns about a stop or a thread starting without waiting
+  # for the next prompt on the command socket.
+  #
+  # Each event is sent as a FramedProtocol::EVENT frame whose payload is
+  # a line of tab-separated <tt>key=value</tt> fields, the first being
+  # the event type: "stop", "trace", "exception", "thread-start",
+  # "thread-exit" or "dropped".
+  #
+  # Publishing never waits on a client. Every client has a bounded
+  # buffer drained by its own writer thread; when a client falls
+  # behind, queued trace events are discarded first, then the oldest
+  # events, and the client is sent a "dropped" event with the count.
+  class EventStream
+    # Events buffered per client before dropping starts.
+    DEFAULT_BUFFER_SIZE = 1024 unless defined?(DEFAULT_BUFFER_SIZE)
+
+    attr_reader :buffer_size
+
+    def initialize(buffer_size = DEFAULT_BUFFER_SIZE)
+      @buffer_size = buffer_size
+      @clients = []
+      @mutex = Mutex.new
+    end
+
+    # Listen for clients on +host+ and +port+.
+    def start(host, port)
+      @server_thread = DebugThread.new do
+        server = TCPServer.new(host, port)
+        while (session = server.accept)
+          client = Client.new(session, @buffer_size).start
+          announce_threads(client)
+          @mutex.synchronize { @clients << client }
+        end
+      end
+      Debugger.on_thread_event do |event, thnum|
+        publish("thread-#{event}", :thnum => thnum)
+      end
+      self
+    end
+
+    def clients?
+      @mutex.synchronize do
+        @clients.reject! { |client| client.closed? }
+        !@clients.empty?
+      end
+    end
+
+    # Queue an event of +type+ with the +fields+ hash for every client.
+    def publish(type, fields = {})
+      @mutex.synchronize do
+        return if @clients.empty?
+        event = [type, fields, Time.now.to_f]
+        @clients.each { |client| client.push(event) }
+      end
+    end
+
+    private
+
+    # Tell a new +client+ about the threads already running; later
+    # ones are reported by Debugger.on_thread_event.
+    def announce_threads(client)
+      Debugger.contexts.each do |context|
+        next if context.ignored?
+        client.push(['thread-start', {:thnum => context.thnum}, Time.now.to_f])
+      end
+    end
+
+    class Client # :nodoc:
+      def initialize(socket, limit)
+        @socket = socket
+        @limit = limit
+        @queue = []
+        @dropped = 0
+        @mutex = Mutex.new
+        @ready = ConditionVariable.new
+        @closed = false
+      end
+
+      def start
+        @writer = DebugThread.new { run }
+        self
+      end
+
+      def closed?
+        @closed
+      end
+
+      def push(event)
+        @mutex.synchronize do
+          if @queue.size >= @limit
+            @dropped += 1
+            i = @queue.index { |queued| queued[0] == 'trace' }
+            if i
+              @queue.delete_at(i)
+            elsif event[0] == 'trace'
+              return
+            else
+              @queue.shift
+            end
+          end
+          @queue << event
+          @ready.signal
+        end
+      end
+
+      private
+
+      def run
+        loop do
+          events, dropped = @mutex.synchronize do
+            @ready.wait(@mutex) while @queue.empty? && @dropped == 0
+            batch, @queue = @queue, []
+            count, @dropped = @dropped, 0
+            [batch, count]
+          end
+          write('dropped', {:count => dropped}, Time.now.to_f) if dropped > 0
+          events.each { |event| write(*event) }
+        end
+      rescue IOError, SystemCallError
+        @closed = true
+        @socket.close rescue nil
+      end
+
+      def write(type, fields, time)
+        line = ["#{type}", "time=%.6f" % time]
+        fields.each do |key, value|
+          line << "#{key}=#{value.to_s.gsub(/[\t\n]/, ' ')}"
+        end
+        FramedProtocol.write(@socket, FramedProtocol::EVENT, 0,
+                             line.join("\t"))
+      end
+    end
+  end
+end
@@ -1,3 +1,5 @@
+require_relative 'protocol'
+
 module Debugger  
   class Interface # :nodoc:
     attr_writer :have_readline  # true if Readline is available
@@ -182,6 +184,65 @@ module Debugger
     end
   end
   
+  # A RemoteInterface speaking FramedProtocol. Commands may arrive
+  # before they are prompted for; they are queued and run in order.
+  # Everything printed while a command runs is tagged with its request
+  # id, and a DONE frame closes the request when the next command is
+  # read.
+  class FramedInterface < RemoteInterface # :nodoc:
+    def initialize(socket)
+      super
+      @pending = []
+      @request_id = 0
+    end
+
+    def confirm(prompt)
+      FramedProtocol.write(@socket, FramedProtocol::CONFIRM, @request_id, prompt)
+      loop do
+        type, id, payload = read_frame
+        return payload if type == FramedProtocol::REPLY
+        @pending << [type, id, payload]
+      end
+    end
+
+    def read_command(prompt)
+      finish_request
+      frame = @pending.shift
+      unless frame
+        FramedProtocol.write(@socket, FramedProtocol::PROMPT, 0, prompt)
+        frame = read_frame
+      end
+      type, @request_id, payload = frame
+      raise IOError, "unexpected frame type #{type}" unless
+        type == FramedProtocol::COMMAND
+      payload
+    end
+
+    def errmsg(*args)
+      FramedProtocol.write(@socket, FramedProtocol::ERROR, @request_id,
+                           format(*args))
+    end
+
+    def print(*args)
+      FramedProtocol.write(@socket, FramedProtocol::OUTPUT, @request_id,
+                           format(*args))
+    end
+
+    private
+
+    def finish_request
+      return if @request_id == 0
+      FramedProtocol.write(@socket, FramedProtocol::DONE, @request_id)
+      @request_id = 0
+    end
+
+    def read_frame
+      frame = FramedProtocol.read(@socket)
+      raise IOError unless frame
+      frame
+    end
+  end
+  
   class ScriptInterface < Interface # :nodoc:
     attr_accessor :command_queue
     attr_accessor :histfile
@@ -67,7 +67,7 @@ module Debugger
       @last_file = nil   # Filename the last time we stopped
       @last_line = nil   # line number the last time we stopped
       @debugger_breakpoints_were_empty = false # Show breakpoints 1st time
-      @debugger_displays_were_empty = true # No display 1st time
+      @display_values_annotated = nil # Display values last annotated
       @debugger_context_was_dead = true # Assume we haven't started.
     end
     
@@ -143,6 +143,9 @@ module Debugger
       line = context.frame_line(0)
       print afmt("%s:%d" % [file, line]) if ENV['EMACS']
       print "Catchpoint at %s:%d: `%s' (%s)\n", file, line, excpt, excpt.class
+      Debugger.publish_event('exception', :thnum => context.thnum,
+                             :file => file, :line => line,
+                             :class => excpt.class, :message => excpt)
       fs = context.stack_size
       tb = caller(0)[-fs..-1]
       if tb
@@ -160,8 +163,15 @@ module Debugger
       file = CommandProcessor.canonic_file(file)
       unless file == @last_file and @last_line == line and 
           Command.settings[:tracing_plus]
-        print "Tracing(%d):%s:%s %s",
-        context.thnum, file, line, Debugger.line_at(file, line)
+        Debugger.publish_event('trace', :thnum => context.thnum,
+                               :file => file, :line => line)
+        # A remote front end reading the event stream gets the trace
+        # there; printing it too would block on the command socket.
+        unless @interface.is_a?(RemoteInterface) && 
+            Debugger.event_stream && Debugger.event_stream.clients?
+          print "Tracing(%d):%s:%s %s",
+          context.thnum, file, line, Debugger.line_at(file, line)
+        end
         @last_file = file
         @last_line = line
       end
@@ -242,6 +252,9 @@ module Debugger
       end
       
       preloop(commands, context)
+      Debugger.publish_event('stop', :thnum => context.thnum,
+                             :file => file, :line => line,
+                             :reason => context.stop_reason)
       CommandProcessor.print_location_and_text(file, line)
       while !state.proceed? 
         input = if @interface.command_queue.empty?
@@ -347,16 +360,24 @@ module Debugger
 
     def display_annotations(commands, context)
       return if display.empty?
-#       have_display = display.find{|d| d[0]} 
-#       return unless have_display and @debugger_displays_were_empty
-#       @debugger_displays_were_empty = have_display
-      annotation('display', commands, context, "display")
+      cmd = commands.find{|c| c.is_a?(DisplayCommand)}
+      return unless cmd
+      # Only annotate when a value changed; the front end keeps what it
+      # was last sent.
+      values = cmd.display_values
+      return if values == @display_values_annotated
+      @display_values_annotated = values
+      print afmt('display')
+      cmd.print_display_values(values)
+      ### FIXME ANNOTATE: the following line should be deleted
+      print "\032\032\n"
     end
 
     class State # :nodoc:
       attr_accessor :context, :file, :line, :binding
       attr_accessor :frame_pos, :previous_line, :display
       attr_accessor :interface, :commands
+      attr_accessor :display_cache # see DisplayFunctions#display_values
 
       def initialize
         super()
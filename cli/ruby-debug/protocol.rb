@@ -0,0 +1,98 @@
+module Debugger
+  # Length-prefixed binary framing for the remote interface. It is an
+  # alternative to the line-oriented text protocol: every message
+  # carries a type and a request id, so a client can send several
+  # commands without waiting for each prompt and can tell which
+  # command produced a piece of output without parsing it.
+  #
+  # A frame is a 9 byte header followed by the payload:
+  #
+  #   length (32-bit big-endian, payload bytes only)
+  #   request id (32-bit big-endian)
+  #   type (8-bit)
+  #
+  # A client using this protocol sends MAGIC right after connecting.
+  # The server expects it when Debugger.protocol is :framed. With
+  # :auto, clients that don't send it get the text protocol.
+  module FramedProtocol
+    MAGIC = "RDBF1\n" unless defined?(MAGIC)
+
+    # client -> debugger
+    COMMAND = 1 unless defined?(COMMAND) # a command line to run
+    REPLY   = 2 unless defined?(REPLY)   # answer to a CONFIRM
+
+    # debugger -> client
+    PROMPT  = 3 unless defined?(PROMPT)  # waiting for a command
+    CONFIRM = 4 unless defined?(CONFIRM) # waiting for a REPLY
+    OUTPUT  = 5 unless defined?(OUTPUT)  # output of a command
+    ERROR   = 6 unless defined?(ERROR)   # error message of a command
+    DONE    = 7 unless defined?(DONE)    # command finished
+    EVENT   = 8 unless defined?(EVENT)   # see EventStream
+
+    HEADER_FORMAT = 'NNC' unless defined?(HEADER_FORMAT)
+    HEADER_SIZE   = 9 unless defined?(HEADER_SIZE)
+    # Frames larger than this are treated as a protocol error.
+    MAX_PAYLOAD   = 16 * 1024 * 1024 unless defined?(MAX_PAYLOAD)
+
+    class << self
+      def pack(type, id, payload = '')
+        payload = payload.to_s
+        payload = payload.dup.force_encoding('BINARY') if
+          payload.respond_to?(:force_encoding)
+        [payload.bytesize, id, type].pack(HEADER_FORMAT) + payload
+      end
+
+      def write(io, type, id, payload = '')
+        io.write(pack(type, id, payload))
+        io.flush
+      end
+
+      # Read one frame from +io+ and return [type, id, payload], or nil
+      # at end of file.
+      def read(io)
+        header = read_exactly(io, HEADER_SIZE)
+        return nil unless header
+        size, id, type = header.unpack(HEADER_FORMAT)
+        raise IOError, "frame of #{size} bytes is too large" if
+          size > MAX_PAYLOAD
+        payload = read_exactly(io, size)
+        raise IOError, 'connection closed inside a frame' unless payload
+        [type, id, payload]
+      end
+
+      # Wait up to +timeout+ seconds for a client to announce the framed
+      # protocol. Returns false if it didn't, after pushing back what it
+      # sent instead, so the text protocol reads it as usual.
+      def handshake?(io, timeout)
+        data = ''
+        data.force_encoding('BINARY') if data.respond_to?(:force_encoding)
+        deadline = Time.now + timeout
+        while data.size < MAGIC.size && MAGIC.start_with?(data)
+          left = deadline - Time.now
+          break unless left > 0 && IO.select([io], nil, nil, left)
+          begin
+            data << io.readpartial(MAGIC.size - data.size)
+          rescue EOFError
+            break
+          end
+        end
+        return true if data == MAGIC
+        io.ungetc(data) unless data.empty?
+        false
+      end
+
+      private
+
+      def read_exactly(io, size)
+        data = ''
+        data.force_encoding('BINARY') if data.respond_to?(:force_encoding)
+        while data.size < size
+          chunk = io.read(size - data.size)
+          return nil if chunk.nil? || chunk.empty?
+          data << chunk
+        end
+        data
+      end
+    end
+  end
+end
@@ -5,10 +5,21 @@
 #include "ruby_debug.h"
 
 VALUE rdebug_breakpoints = Qnil;
-VALUE rdebug_catchpoints;
+int   rdebug_catchpoint_count = 0;
+int   rdebug_nonstop_count = 0;  /* logpoints and snapshot points */
+
+/* longest inspect() of a value written by a logpoint */
+#define LOGPOINT_MAX_VALUE 256
 
 static VALUE cBreakpoint;
 static ID    idEval;
+static ID    idSelf;
+static FILE *log_sink = NULL;  /* NULL for stderr */
+static VALUE log_sink_path = Qnil;
+
+#ifndef GET_PREV_DFP
+#define GET_PREV_DFP(dfp) ((VALUE *)((dfp)[0] & ~0x03))
+#endif
 
 static VALUE
 eval_expression(VALUE args)
@@ -53,8 +64,22 @@ check_breakpoint_hit_condition(VALUE breakpoint)
     return 0;
 }
 
+/* Returns whether the breakpoint applies to thread number +thnum+. */
+static int
+check_breakpoint_thread(debug_breakpoint_t *debug_breakpoint, int thnum)
+{
+    int i;
+
+    if(debug_breakpoint->thnum_count == 0)
+        return 1;
+    for(i = 0; i < debug_breakpoint->thnum_count; i++)
+        if(debug_breakpoint->thnums[i] == thnum)
+            return 1;
+    return 0;
+}
+
 static int
-check_breakpoint_by_pos(VALUE breakpoint, const char *file, int line)
+check_breakpoint_by_pos(VALUE breakpoint, int thnum, const char *file, int line)
 {
     debug_breakpoint_t *debug_breakpoint;
 
@@ -64,15 +89,19 @@ check_breakpoint_by_pos(VALUE breakpoint, const char *file, int line)
     if (!Qtrue == debug_breakpoint->enabled) return 0;
     if(debug_breakpoint->type != BP_POS_TYPE)
         return 0;
+    if(debug_breakpoint->action != BP_ACTION_STOP)
+        return 0;
     if(debug_breakpoint->pos.line != line)
         return 0;
+    if(!check_breakpoint_thread(debug_breakpoint, thnum))
+        return 0;
     if(filename_cmp(debug_breakpoint->source, file))
         return 1;
     return 0;
 }
 
 int
-check_breakpoint_by_method(VALUE breakpoint, VALUE klass, ID mid, VALUE self)
+check_breakpoint_by_method(VALUE breakpoint, int thnum, VALUE klass, ID mid, VALUE self)
 {
     debug_breakpoint_t *debug_breakpoint;
 
@@ -84,6 +113,8 @@ check_breakpoint_by_method(VALUE breakpoint, VALUE klass, ID mid, VALUE self)
         return 0;
     if(debug_breakpoint->pos.mid != mid)
         return 0;
+    if(!check_breakpoint_thread(debug_breakpoint, thnum))
+        return 0;
     if(classname_cmp(debug_breakpoint->source, klass))
         return 1;
     if ((rb_type(self) == T_CLASS) &&
@@ -101,7 +132,8 @@ check_breakpoints_by_pos(debug_context_t *debug_context, const char *file, int l
     if(!CTX_FL_TEST(debug_context, CTX_FL_ENABLE_BKPT))
         return Qnil;
 
-    if(check_breakpoint_by_pos(debug_context->breakpoint, file, line))
+    if(check_breakpoint_by_pos(debug_context->breakpoint, debug_context->thnum,
+                               file, line))
         return debug_context->breakpoint;
 
     if(RARRAY_LEN(rdebug_breakpoints) == 0)
@@ -109,7 +141,7 @@ check_breakpoints_by_pos(debug_context_t *debug_context, const char *file, int l
     for(i = 0; i < RARRAY_LEN(rdebug_breakpoints); i++)
     {
         breakpoint = rb_ary_entry(rdebug_breakpoints, i);
-        if(check_breakpoint_by_pos(breakpoint, file, line))
+        if(check_breakpoint_by_pos(breakpoint, debug_context->thnum, file, line))
             return breakpoint;
     }
     return Qnil;
@@ -124,7 +156,8 @@ check_breakpoints_by_method(debug_context_t *debug_context, VALUE klass, ID mid,
     if(!CTX_FL_TEST(debug_context, CTX_FL_ENABLE_BKPT))
         return Qnil;
 
-    if(check_breakpoint_by_method(debug_context->breakpoint, klass, mid, self))
+    if(check_breakpoint_by_method(debug_context->breakpoint, debug_context->thnum,
+                                  klass, mid, self))
         return debug_context->breakpoint;
 
     if(RARRAY_LEN(rdebug_breakpoints) == 0)
@@ -132,24 +165,40 @@ check_breakpoints_by_method(debug_context_t *debug_context, VALUE klass, ID mid,
     for(i = 0; i < RARRAY_LEN(rdebug_breakpoints); i++)
     {
         breakpoint = rb_ary_entry(rdebug_breakpoints, i);
-        if(check_breakpoint_by_method(breakpoint, klass, mid, self))
+        if(check_breakpoint_by_method(breakpoint, debug_context->thnum, klass, mid, self))
             return breakpoint;
     }
     return Qnil;
 }
 
+/*
+ * Checks the condition of +breakpoint+ in frame +cfp+, which must be
+ * the frame the event hook was called for.
+ */
 int
-check_breakpoint_expression(VALUE breakpoint, VALUE binding)
+check_breakpoint_expression(VALUE breakpoint, rb_control_frame_t *cfp)
 {
     debug_breakpoint_t *debug_breakpoint;
     VALUE args, expr_result;
+    double start;
+    int result;
 
     Data_Get_Struct(breakpoint, debug_breakpoint_t, debug_breakpoint);
+    /* a breakpoint the governor has put on sampling skips the other hits */
+    if(debug_breakpoint->sample > 1 &&
+       ++debug_breakpoint->sample_seen % debug_breakpoint->sample != 0)
+        return 0;
     if(NIL_P(debug_breakpoint->expr))
         return 1;
 
-    args = rb_ary_new3(2, debug_breakpoint->expr, binding);
+    if(check_native_condition(debug_breakpoint, cfp, &result))
+        return result;
+
+    start = governor_on ? governor_clock() : 0;
+    args = rb_ary_new3(2, debug_breakpoint->expr, rb_binding_new());
     expr_result = rb_protect(eval_expression, args, 0);
+    if(governor_on)
+        governor_charge_breakpoint(debug_breakpoint, start);
     return RTEST(expr_result);
 }
 
@@ -160,6 +209,17 @@ breakpoint_mark(void *data)
     breakpoint = (debug_breakpoint_t *)data;
     rb_gc_mark(breakpoint->source);
     rb_gc_mark(breakpoint->expr);
+    rb_gc_mark(breakpoint->format);
+    rb_gc_mark(breakpoint->template);
+    rb_gc_mark(breakpoint->cond_value);
+}
+
+static void
+breakpoint_free(void *data)
+{
+    debug_breakpoint_t *breakpoint = (debug_breakpoint_t *)data;
+    xfree(breakpoint->thnums);
+    xfree(breakpoint);
 }
 
 VALUE
@@ -188,10 +248,339 @@ create_breakpoint_from_args(int argc, VALUE *argv, int id)
         breakpoint->pos.mid = rb_intern(RSTRING_PTR(pos));
     breakpoint->enabled = Qtrue;
     breakpoint->expr = NIL_P(expr) ? expr: StringValue(expr);
+    compile_condition(breakpoint);
     breakpoint->hit_count = 0;
     breakpoint->hit_value = 0;
     breakpoint->hit_condition = HIT_COND_NONE;
-    return Data_Wrap_Struct(cBreakpoint, breakpoint_mark, xfree, breakpoint);
+    breakpoint->action = BP_ACTION_STOP;
+    breakpoint->format = Qnil;
+    breakpoint->template = Qnil;
+    breakpoint->max_depth = 0;
+    breakpoint->max_bytes = 0;
+    breakpoint->remaining = 0;
+    breakpoint->sample = 0;
+    breakpoint->sample_seen = 0;
+    breakpoint->cost = 0;
+    breakpoint->thnums = NULL;
+    breakpoint->thnum_count = 0;
+    return Data_Wrap_Struct(cBreakpoint, breakpoint_mark, breakpoint_free, breakpoint);
+}
+
+/*
+ * Splits a logpoint format into an array of literal strings and
+ * symbols naming what to insert: a local variable, an instance
+ * variable (:@name) or :self. "{{" and "}}" stand for braces.
+ */
+static VALUE
+parse_log_format(VALUE format)
+{
+    VALUE template = rb_ary_new();
+    VALUE literal = rb_str_new(0, 0);
+    const char *p = RSTRING_PTR(format);
+    const char *end = p + RSTRING_LEN(format);
+
+    while(p < end)
+    {
+        const char *close;
+
+        if((*p == '{' || *p == '}') && p + 1 < end && p[1] == *p)
+        {
+            rb_str_cat(literal, p, 1);
+            p += 2;
+            continue;
+        }
+        if(*p != '{')
+        {
+            rb_str_cat(literal, p++, 1);
+            continue;
+        }
+        for(close = p + 1; close < end && *close != '}'; close++)
+            ;
+        if(close == end || close == p + 1)
+            rb_raise(rb_eArgError, "Bad logpoint format: %s", RSTRING_PTR(format));
+        if(RSTRING_LEN(literal) > 0)
+        {
+            rb_ary_push(template, literal);
+            literal = rb_str_new(0, 0);
+        }
+        rb_ary_push(template, ID2SYM(rb_intern2(p + 1, close - p - 1)));
+        p = close + 1;
+    }
+    if(RSTRING_LEN(literal) > 0)
+        rb_ary_push(template, literal);
+    return template;
+}
+
+VALUE
+create_logpoint(VALUE source, VALUE line, VALUE format, int id)
+{
+    VALUE args[2];
+    VALUE result;
+    debug_breakpoint_t *breakpoint;
+
+    args[0] = source;
+    args[1] = line;
+    if(!FIXNUM_P(line))
+        rb_raise(rb_eTypeError, "logpoint line must be an Integer");
+    StringValue(format);
+    result = create_breakpoint_from_args(2, args, id);
+    Data_Get_Struct(result, debug_breakpoint_t, breakpoint);
+    breakpoint->action = BP_ACTION_LOG;
+    breakpoint->format = rb_str_dup(format);
+    breakpoint->template = parse_log_format(format);
+    return result;
+}
+
+VALUE
+create_snapshot_point(VALUE source, VALUE line, int id, int max_depth,
+    int max_bytes, int count)
+{
+    VALUE args[2];
+    VALUE result;
+    debug_breakpoint_t *breakpoint;
+
+    args[0] = source;
+    args[1] = line;
+    if(!FIXNUM_P(line))
+        rb_raise(rb_eTypeError, "snapshot line must be an Integer");
+    if(max_depth < 1 || max_bytes < 1 || count < 1)
+        rb_raise(rb_eArgError, "snapshot limits must be positive");
+    result = create_breakpoint_from_args(2, args, id);
+    Data_Get_Struct(result, debug_breakpoint_t, breakpoint);
+    breakpoint->action = BP_ACTION_SNAPSHOT;
+    breakpoint->max_depth = max_depth;
+    breakpoint->max_bytes = max_bytes;
+    breakpoint->remaining = count;
+    return result;
+}
+
+/* Looks up local +id+ in +cfp+ and the frames its block is nested in. */
+int
+frame_local(rb_control_frame_t *cfp, ID id, VALUE *value)
+{
+    rb_iseq_t *iseq = cfp->iseq;
+    VALUE *dfp = cfp->dfp;
+    int i;
+
+    while(iseq != NULL && dfp != NULL)
+    {
+        for(i = 0; i < iseq->local_table_size; i++)
+        {
+            if(iseq->local_table[i] == id)
+            {
+                *value = *(dfp - iseq->local_size + i);
+                return 1;
+            }
+        }
+        if(dfp == cfp->lfp)
+            break;
+        dfp = GET_PREV_DFP(dfp);
+        iseq = iseq->parent_iseq;
+    }
+    return 0;
+}
+
+static VALUE
+inspect_value(VALUE args)
+{
+    VALUE str = rb_inspect(RARRAY_PTR(args)[0]);
+    long max = NUM2LONG(RARRAY_PTR(args)[1]);
+
+    if(RSTRING_LEN(str) > max)
+    {
+        str = rb_str_substr(str, 0, max - 3);
+        rb_str_cat2(str, "...");
+    }
+    return str;
+}
+
+/*
+ * Returns value.inspect cut to +max+ characters. Never raises: an
+ * inspect that fails is shown as "<inspect failed>".
+ */
+VALUE
+inspect_bounded(VALUE value, long max)
+{
+    VALUE str;
+    int state;
+
+    str = rb_protect(inspect_value, rb_ary_new3(2, value, LONG2NUM(max)), &state);
+    if(state)
+    {
+        rb_set_errinfo(Qnil);
+        return rb_str_new2("<inspect failed>");
+    }
+    return str;
+}
+
+static VALUE
+format_logpoint(VALUE template, rb_control_frame_t *cfp)
+{
+    VALUE message = rb_str_buf_new(64);
+    VALUE part, value;
+    ID id;
+    int i;
+
+    for(i = 0; i < RARRAY_LEN(template); i++)
+    {
+        part = RARRAY_PTR(template)[i];
+        if(TYPE(part) == T_STRING)
+        {
+            rb_str_buf_append(message, part);
+            continue;
+        }
+        id = SYM2ID(part);
+        if(id == idSelf)
+            value = cfp->self;
+        else if(rb_is_instance_id(id))
+        {
+            if(!rb_ivar_defined(cfp->self, id))
+            {
+                rb_str_cat2(message, "nil");
+                continue;
+            }
+            value = rb_ivar_get(cfp->self, id);
+        }
+        else if(!frame_local(cfp, id, &value))
+        {
+            rb_str_cat2(message, "<undefined>");
+            continue;
+        }
+        rb_str_buf_append(message, inspect_bounded(value, LOGPOINT_MAX_VALUE));
+    }
+    return message;
+}
+
+static void
+write_log(const char *file, int line, VALUE message)
+{
+    FILE *sink = log_sink ? log_sink : stderr;
+
+    fprintf(sink, "%s:%d: ", file, line);
+    fwrite(RSTRING_PTR(message), 1, RSTRING_LEN(message), sink);
+    fputc('\n', sink);
+    fflush(sink);
+}
+
+/*
+ * Runs every logpoint and snapshot point at +file+:+line+ that is due
+ * according to its condition and hit condition. Called from the event
+ * hook before it takes the debugger lock: these never stop the thread.
+ */
+void
+check_nonstop_breakpoints(debug_context_t *debug_context, rb_control_frame_t *cfp,
+    const char *file, int line)
+{
+    VALUE breakpoint;
+    debug_breakpoint_t *debug_breakpoint;
+    int i, ignored;
+
+    for(i = 0; i < RARRAY_LEN(rdebug_breakpoints); i++)
+    {
+        breakpoint = rb_ary_entry(rdebug_breakpoints, i);
+        Data_Get_Struct(breakpoint, debug_breakpoint_t, debug_breakpoint);
+        if(debug_breakpoint->action == BP_ACTION_STOP ||
+           debug_breakpoint->pos.line != line ||
+           debug_breakpoint->enabled != Qtrue ||
+           !check_breakpoint_thread(debug_breakpoint, debug_context->thnum) ||
+           !filename_cmp(debug_breakpoint->source, file))
+            continue;
+
+        /* don't trace the code run to format the message */
+        ignored = CTX_FL_TEST(debug_context, CTX_FL_IGNORE);
+        CTX_FL_SET(debug_context, CTX_FL_IGNORE);
+        if(check_breakpoint_expression(breakpoint, cfp) &&
+           check_breakpoint_hit_condition(breakpoint))
+        {
+            double start = governor_on ? governor_clock() : 0;
+
+            if(debug_breakpoint->action == BP_ACTION_LOG)
+                write_log(file, line, format_logpoint(debug_breakpoint->template, cfp));
+            else
+            {
+                take_snapshot(debug_context, debug_breakpoint, cfp, file, line);
+                if(--debug_breakpoint->remaining <= 0)
+                    debug_breakpoint->enabled = Qfalse;
+            }
+            if(governor_on)
+                governor_charge_breakpoint(debug_breakpoint, start);
+        }
+        if(!ignored)
+            CTX_FL_UNSET(debug_context, CTX_FL_IGNORE);
+    }
+}
+
+/*
+ *   call-seq:
+ *      Debugger.log_file = path or nil
+ *
+ *   Sets the file logpoint messages are appended to. With nil they go
+ *   to standard error.
+ */
+static VALUE
+debug_set_log_file(VALUE self, VALUE path)
+{
+    FILE *sink = NULL;
+
+    if(!NIL_P(path))
+    {
+        StringValue(path);
+        sink = fopen(RSTRING_PTR(path), "a");
+        if(sink == NULL)
+            rb_sys_fail(RSTRING_PTR(path));
+        path = rb_str_dup(path);
+    }
+    if(log_sink)
+        fclose(log_sink);
+    log_sink = sink;
+    log_sink_path = path;
+    return path;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.log_file -> path or nil
+ *
+ *   Returns the file logpoint messages are appended to, nil for
+ *   standard error.
+ */
+static VALUE
+debug_log_file(VALUE self)
+{
+    return log_sink_path;
+}
+
+/*
+ * Moves a line breakpoint on a line with no code to the next line that
+ * has some, when the code of its file is loaded. Raises ArgumentError
+ * if there is no such line, since the breakpoint could never be hit.
+ */
+void
+snap_breakpoint_line(VALUE breakpoint)
+{
+    debug_breakpoint_t *debug_breakpoint;
+    int *lines;
+    int lo, hi, n;
+
+    Data_Get_Struct(breakpoint, debug_breakpoint_t, debug_breakpoint);
+    if(debug_breakpoint->type != BP_POS_TYPE)
+        return;
+    n = executable_lines(debug_breakpoint->source, &lines);
+    if(n < 0)
+        return;
+    for(lo = 0, hi = n; lo < hi; )
+    {
+        int mid = (lo + hi) / 2;
+        if(lines[mid] < debug_breakpoint->pos.line)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo < n)
+        debug_breakpoint->pos.line = lines[lo];
+    if(lo == n)
+        rb_raise(rb_eArgError, "No code at or after line %d in %s",
+            debug_breakpoint->pos.line, RSTRING_PTR(debug_breakpoint->source));
 }
 
 /*
@@ -217,6 +606,8 @@ rdebug_remove_breakpoint(VALUE self, VALUE id_value)
         Data_Get_Struct(breakpoint, debug_breakpoint_t, debug_breakpoint);
         if(debug_breakpoint->id == id)
         {
+            if(debug_breakpoint->action != BP_ACTION_STOP)
+                rdebug_nonstop_count--;
             rb_ary_delete_at(rdebug_breakpoints, i);
             return breakpoint;
         }
@@ -224,36 +615,264 @@ rdebug_remove_breakpoint(VALUE self, VALUE id_value)
     return Qnil;
 }
 
+/*
+ * Catchpoints are kept as resolved classes, so anonymous classes work
+ * and no names are built when an exception is raised. A catchpoint
+ * given as the name of a class that doesn't exist yet is resolved the
+ * next time an exception of a class not seen before is raised. Which
+ * catchpoint, if any, matches a raised class is worked out once from
+ * its ancestors and cached until the catchpoints change. The cache
+ * marks the classes in it, so only named classes, which live as long
+ * as their constant anyway, are cached; anonymous ones are looked up
+ * every time rather than kept alive.
+ */
+typedef struct {
+    VALUE name;       /* as given, or the name of the class given */
+    VALUE klass;      /* Qnil until name resolves */
+    int hits;
+} catchpoint_t;
+
+static catchpoint_t *catchpoints = NULL;
+static int catchpoint_capa = 0;
+static int catchpoint_unresolved = 0;
+static st_table *catch_cache = NULL;  /* raised class -> index + 1, 0 for none */
+static VALUE catchpoint_holder = Qnil; /* marks what the above refer to */
+
+static int
+catch_cache_mark_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    rb_gc_mark((VALUE)key);
+    return ST_CONTINUE;
+}
+
+static void
+catchpoints_mark(void *data)
+{
+    int i;
+
+    for(i = 0; i < rdebug_catchpoint_count; i++)
+    {
+        rb_gc_mark(catchpoints[i].name);
+        rb_gc_mark(catchpoints[i].klass);
+    }
+    st_foreach(catch_cache, catch_cache_mark_i, 0);
+}
+
+static VALUE
+resolve_class(VALUE name)
+{
+    return rb_path2class(RSTRING_PTR(name));
+}
+
+static void
+resolve_catchpoints()
+{
+    VALUE klass;
+    int i, state;
+
+    for(i = 0; i < rdebug_catchpoint_count; i++)
+    {
+        if(!NIL_P(catchpoints[i].klass))
+            continue;
+        klass = rb_protect(resolve_class, catchpoints[i].name, &state);
+        if(state)
+        {
+            rb_set_errinfo(Qnil);
+            continue;
+        }
+        catchpoints[i].klass = klass;
+        catchpoint_unresolved--;
+    }
+}
+
+static int
+catchpoint_index(VALUE name)
+{
+    int i;
+
+    for(i = 0; i < rdebug_catchpoint_count; i++)
+        if(rb_str_equal(catchpoints[i].name, name) == Qtrue)
+            return i;
+    return -1;
+}
+
+/*
+ * Returns the name of the catchpoint that catches exceptions of class
+ * +klass+, or Qnil if there is none.
+ */
+VALUE
+find_catchpoint(VALUE klass)
+{
+    VALUE ancestors;
+    st_data_t found;
+    int i, j, index = -1;
+
+    if(!st_lookup(catch_cache, (st_data_t)klass, &found))
+    {
+        if(catchpoint_unresolved > 0)
+            resolve_catchpoints();
+        ancestors = rb_mod_ancestors(klass);
+        for(i = 0; i < RARRAY_LEN(ancestors) && index < 0; i++)
+            for(j = 0; j < rdebug_catchpoint_count; j++)
+                if(catchpoints[j].klass == RARRAY_PTR(ancestors)[i])
+                {
+                    index = j;
+                    break;
+                }
+        found = index + 1;
+        if(!NIL_P(rb_mod_name(klass)))
+            st_insert(catch_cache, (st_data_t)klass, found);
+    }
+    return found ? catchpoints[found - 1].name : Qnil;
+}
+
+/* Counts a stop at the catchpoint named +name+. */
+void
+catchpoint_hit(VALUE name)
+{
+    int i;
+
+    if(TYPE(name) != T_STRING)
+        return; /* caught by catchall */
+    i = catchpoint_index(name);
+    if(i >= 0)
+        catchpoints[i].hits++;
+}
+
 /*
  *   call-seq:
  *      Debugger.catchpoints -> hash
  *
  *   Returns a current catchpoints, which is a hash exception names that will
  *   trigger a debugger when raised. The values are the number of times taht
- *   catchpoint was hit, initially 0.
+ *   catchpoint was hit, initially 0. Changing the hash doesn't change the
+ *   catchpoints; see Debugger.remove_catchpoint.
  */
 VALUE
 debug_catchpoints(VALUE self)
 {
-    return rdebug_catchpoints;
+    VALUE result = rb_hash_new();
+    int i;
+
+    for(i = 0; i < rdebug_catchpoint_count; i++)
+        rb_hash_aset(result, rb_str_dup(catchpoints[i].name),
+                     INT2FIX(catchpoints[i].hits));
+    return result;
 }
 
 /*
  *   call-seq:
- *      Debugger.catchpoint(string) -> string
+ *      Debugger.add_catchpoint(string or class) -> string or class
  *
- *   Sets catchpoint. Returns the string passed.
+ *   Sets catchpoint. Returns the value passed. An exception is caught if
+ *   its class is, or inherits from, the class given or named; a name
+ *   need not refer to a class yet.
  */
 VALUE
 rdebug_add_catchpoint(VALUE self, VALUE value)
 {
-    if (TYPE(value) != T_STRING) {
-        rb_raise(rb_eTypeError, "value of a catchpoint must be String");
+    VALUE name, klass = Qnil;
+    int i;
+
+    if(TYPE(value) == T_CLASS || TYPE(value) == T_MODULE)
+    {
+        klass = value;
+        name = rb_mod_name(value);
+        if(NIL_P(name))
+            name = rb_inspect(value);
+    }
+    else if(TYPE(value) == T_STRING)
+        name = value;
+    else
+        rb_raise(rb_eTypeError, "value of a catchpoint must be String or Class");
+
+    i = catchpoint_index(name);
+    if(i < 0)
+    {
+        if(rdebug_catchpoint_count == catchpoint_capa)
+        {
+            catchpoint_capa = catchpoint_capa ? catchpoint_capa * 2 : 8;
+            REALLOC_N(catchpoints, catchpoint_t, catchpoint_capa);
+        }
+        i = rdebug_catchpoint_count++;
+        catchpoints[i].klass = Qnil;
+        catchpoint_unresolved++;
+    }
+    catchpoints[i].name = rb_str_dup(name);
+    catchpoints[i].hits = 0;
+    if(!NIL_P(klass) && NIL_P(catchpoints[i].klass))
+    {
+        catchpoints[i].klass = klass;
+        catchpoint_unresolved--;
     }
-    rb_hash_aset(rdebug_catchpoints, rb_str_dup(value), INT2FIX(0));
+    st_clear(catch_cache);
     return value;
 }
 
+/*
+ *   call-seq:
+ *      Debugger.remove_catchpoint(string or class) -> bool
+ *
+ *   Removes the catchpoint for the exception named +string+, or for
+ *   +class+. Returns false if there is none.
+ */
+static VALUE
+rdebug_remove_catchpoint(VALUE self, VALUE value)
+{
+    int i = -1;
+
+    if(TYPE(value) == T_CLASS || TYPE(value) == T_MODULE)
+    {
+        for(i = rdebug_catchpoint_count - 1; i >= 0; i--)
+            if(catchpoints[i].klass == value)
+                break;
+    }
+    else
+    {
+        StringValue(value);
+        i = catchpoint_index(value);
+    }
+    if(i < 0)
+        return Qfalse;
+    if(NIL_P(catchpoints[i].klass))
+        catchpoint_unresolved--;
+    rdebug_catchpoint_count--;
+    memmove(catchpoints + i, catchpoints + i + 1,
+            (rdebug_catchpoint_count - i) * sizeof(catchpoint_t));
+    st_clear(catch_cache);
+    return Qtrue;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.clear_catchpoints -> nil
+ *
+ *   Removes every catchpoint.
+ */
+static VALUE
+rdebug_clear_catchpoints(VALUE self)
+{
+    rdebug_catchpoint_count = 0;
+    catchpoint_unresolved = 0;
+    st_clear(catch_cache);
+    return Qnil;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.catchpoint_for(klass) -> string or nil
+ *
+ *   Returns the name of the catchpoint that catches exceptions of class
+ *   +klass+, nil if they aren't caught.
+ */
+static VALUE
+rdebug_catchpoint_for(VALUE self, VALUE klass)
+{
+    if(TYPE(klass) != T_CLASS)
+        rb_raise(rb_eTypeError, "expected a Class");
+    return find_catchpoint(klass);
+}
+
 /*
  *   call-seq:
  *      context.breakpoint -> breakpoint
@@ -422,9 +1041,81 @@ breakpoint_set_expr(VALUE self, VALUE expr)
 
     Data_Get_Struct(self, debug_breakpoint_t, breakpoint);
     breakpoint->expr = NIL_P(expr) ? expr: StringValue(expr);
+    compile_condition(breakpoint);
     return expr;
 }
 
+/*
+ *   call-seq:
+ *      breakpoint.threads -> array or nil
+ *
+ *   Returns the numbers of the threads the breakpoint applies to, nil
+ *   if it applies to all threads.
+ */
+static VALUE
+breakpoint_threads(VALUE self)
+{
+    debug_breakpoint_t *breakpoint;
+    VALUE result;
+    int i;
+
+    Data_Get_Struct(self, debug_breakpoint_t, breakpoint);
+    if(breakpoint->thnum_count == 0)
+        return Qnil;
+    result = rb_ary_new2(breakpoint->thnum_count);
+    for(i = 0; i < breakpoint->thnum_count; i++)
+        rb_ary_push(result, INT2FIX(breakpoint->thnums[i]));
+    return result;
+}
+
+/*
+ *   call-seq:
+ *      breakpoint.threads = array or nil
+ *
+ *   Makes the breakpoint apply only to the threads whose numbers
+ *   (Context#thnum) are in +array+; with nil it applies to all threads.
+ *   Other threads pass the breakpoint without its condition being
+ *   checked.
+ */
+static VALUE
+breakpoint_set_threads(VALUE self, VALUE threads)
+{
+    debug_breakpoint_t *breakpoint;
+    int *thnums = NULL;
+    int i, count = 0;
+
+    Data_Get_Struct(self, debug_breakpoint_t, breakpoint);
+    if(!NIL_P(threads))
+    {
+        Check_Type(threads, T_ARRAY);
+        count = (int)RARRAY_LEN(threads);
+        thnums = ALLOC_N(int, count > 0 ? count : 1);
+        for(i = 0; i < count; i++)
+            thnums[i] = NUM2INT(RARRAY_PTR(threads)[i]);
+    }
+    xfree(breakpoint->thnums);
+    breakpoint->thnums = thnums;
+    breakpoint->thnum_count = count;
+    return threads;
+}
+
+/*
+ *   call-seq:
+ *      breakpoint.native_condition? -> bool
+ *
+ *   Returns true if the breakpoint's condition is simple enough to be
+ *   checked without eval, such as <tt>count > 10</tt> or
+ *   <tt>@state == :failed</tt>.
+ */
+static VALUE
+breakpoint_native_condition(VALUE self)
+{
+    debug_breakpoint_t *breakpoint;
+
+    Data_Get_Struct(self, debug_breakpoint_t, breakpoint);
+    return breakpoint->cond_op ? Qtrue : Qfalse;
+}
+
 /*
  *   call-seq:
  *      breakpoint.id -> int
@@ -544,6 +1235,79 @@ breakpoint_set_hit_condition(VALUE self, VALUE value)
     return value;
 }
 
+/*
+ *   call-seq:
+ *      breakpoint.action -> symbol
+ *
+ *   Returns what the breakpoint does when hit: :stop, :log for a
+ *   logpoint or :snapshot for a snapshot point.
+ */
+static VALUE
+breakpoint_action(VALUE self)
+{
+    debug_breakpoint_t *breakpoint;
+
+    Data_Get_Struct(self, debug_breakpoint_t, breakpoint);
+    switch(breakpoint->action)
+    {
+        case BP_ACTION_LOG:
+            return ID2SYM(rb_intern("log"));
+        case BP_ACTION_SNAPSHOT:
+            return ID2SYM(rb_intern("snapshot"));
+        default:
+            return ID2SYM(rb_intern("stop"));
+    }
+}
+
+/*
+ *   call-seq:
+ *      breakpoint.snapshots_left -> int
+ *
+ *   Returns how many more snapshots a snapshot point takes before it
+ *   disables itself, 0 for other breakpoints.
+ */
+static VALUE
+breakpoint_snapshots_left(VALUE self)
+{
+    debug_breakpoint_t *breakpoint;
+
+    Data_Get_Struct(self, debug_breakpoint_t, breakpoint);
+    if(breakpoint->action != BP_ACTION_SNAPSHOT || breakpoint->remaining < 0)
+        return INT2FIX(0);
+    return INT2FIX(breakpoint->remaining);
+}
+
+/*
+ *   call-seq:
+ *      breakpoint.sample -> int
+ *
+ *   Returns n if the CPU governor has degraded the breakpoint to look
+ *   at only one hit in n, 1 otherwise. See Debugger.cpu_budget.
+ */
+static VALUE
+breakpoint_sample(VALUE self)
+{
+    debug_breakpoint_t *breakpoint;
+
+    Data_Get_Struct(self, debug_breakpoint_t, breakpoint);
+    return INT2FIX(breakpoint->sample > 1 ? breakpoint->sample : 1);
+}
+
+/*
+ *   call-seq:
+ *      breakpoint.format -> string or nil
+ *
+ *   Returns the message template of a logpoint.
+ */
+static VALUE
+breakpoint_format(VALUE self)
+{
+    debug_breakpoint_t *breakpoint;
+
+    Data_Get_Struct(self, debug_breakpoint_t, breakpoint);
+    return breakpoint->format;
+}
+
 /*
  *   Document-class: Breakpoint
  *
@@ -560,6 +1324,9 @@ Init_breakpoint()
     rb_define_method(cBreakpoint, "enabled?", breakpoint_enabled, 0);
     rb_define_method(cBreakpoint, "expr", breakpoint_expr, 0);
     rb_define_method(cBreakpoint, "expr=", breakpoint_set_expr, 1);
+    rb_define_method(cBreakpoint, "native_condition?", breakpoint_native_condition, 0);
+    rb_define_method(cBreakpoint, "threads", breakpoint_threads, 0);
+    rb_define_method(cBreakpoint, "threads=", breakpoint_set_threads, 1);
     rb_define_method(cBreakpoint, "hit_condition", breakpoint_hit_condition, 0);
     rb_define_method(cBreakpoint, "hit_condition=", breakpoint_set_hit_condition, 1);
     rb_define_method(cBreakpoint, "hit_count", breakpoint_hit_count, 0);
@@ -570,8 +1337,22 @@ Init_breakpoint()
     rb_define_method(cBreakpoint, "pos=", breakpoint_set_pos, 1);
     rb_define_method(cBreakpoint, "source", breakpoint_source, 0);
     rb_define_method(cBreakpoint, "source=", breakpoint_set_source, 1);
+    rb_define_method(cBreakpoint, "action", breakpoint_action, 0);
+    rb_define_method(cBreakpoint, "snapshots_left", breakpoint_snapshots_left, 0);
+    rb_define_method(cBreakpoint, "sample", breakpoint_sample, 0);
+    rb_define_method(cBreakpoint, "format", breakpoint_format, 0);
+    rb_define_module_function(mDebugger, "log_file", debug_log_file, 0);
+    rb_define_module_function(mDebugger, "log_file=", debug_set_log_file, 1);
     idEval             = rb_intern("eval");
-    rdebug_catchpoints = rb_hash_new();
+    idSelf             = rb_intern("self");
+    rb_global_variable(&log_sink_path);
+
+    rb_define_module_function(mDebugger, "remove_catchpoint", rdebug_remove_catchpoint, 1);
+    rb_define_module_function(mDebugger, "clear_catchpoints", rdebug_clear_catchpoints, 0);
+    rb_define_module_function(mDebugger, "catchpoint_for", rdebug_catchpoint_for, 1);
+    catch_cache = st_init_numtable();
+    catchpoint_holder = Data_Wrap_Struct(rb_cObject, catchpoints_mark, 0, 0);
+    rb_global_variable(&catchpoint_holder);
 
 }
 
@@ -0,0 +1,251 @@
+#include <ruby.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vm_core.h>
+#include <iseq.h>
+#include "ruby_debug.h"
+
+/*
+ * Breakpoint conditions simple enough to check without eval: a local
+ * or instance variable compared with a literal,
+ *
+ *   name OP literal      OP is ==, !=, <, >, <= or >=
+ *   name.nil?
+ *
+ * where name is a local variable or @ivar and literal an integer,
+ * float, string without escapes, symbol, nil, true or false. The
+ * variable is read straight from the frame. Anything else, or a name
+ * that isn't a local of the frame (it would be a method call), is left
+ * to Kernel#eval.
+ */
+
+static ID idEq, idNeq, idLt, idGt, idLe, idGe, idNilP;
+
+static const char *
+skip_space(const char *p)
+{
+    while(*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+static int
+is_ident_char(int c)
+{
+    return isalnum(c) || c == '_';
+}
+
+/* Reads an identifier, returning the character after it or NULL. */
+static const char *
+scan_ident(const char *p, const char **start)
+{
+    *start = p;
+    if(!(isalpha((unsigned char)*p) || *p == '_'))
+        return NULL;
+    while(is_ident_char((unsigned char)*p))
+        p++;
+    return p;
+}
+
+static int
+is_keyword(const char *name, long len)
+{
+    static const char *keywords[] = {"nil", "true", "false", "self",
+        "__FILE__", "__LINE__", "defined", NULL};
+    int i;
+
+    for(i = 0; keywords[i]; i++)
+        if((long)strlen(keywords[i]) == len && !strncmp(keywords[i], name, len))
+            return 1;
+    return 0;
+}
+
+/* Reads a literal into *value, returning the character after it or NULL. */
+static const char *
+scan_literal(const char *p, VALUE *value)
+{
+    const char *start = p, *end;
+
+    if(*p == '"' || *p == '\'')
+    {
+        for(end = p + 1; *end && *end != *p; end++)
+            if(*end == '\\' || (*p == '"' && *end == '#'))
+                return NULL;
+        if(*end != *p)
+            return NULL;
+        *value = rb_obj_freeze(rb_str_new(p + 1, end - p - 1));
+        return end + 1;
+    }
+    if(*p == ':')
+    {
+        if((end = scan_ident(p + 1, &start)) == NULL)
+            return NULL;
+        if(*end == '?' || *end == '!')
+            end++;
+        *value = ID2SYM(rb_intern2(start, end - start));
+        return end;
+    }
+    if(*p == '-' || isdigit((unsigned char)*p))
+    {
+        char *buf;
+        int is_float = 0;
+
+        end = p + (*p == '-');
+        if(!isdigit((unsigned char)*end))
+            return NULL;
+        while(isdigit((unsigned char)*end))
+            end++;
+        if(*end == '.' && isdigit((unsigned char)end[1]))
+        {
+            is_float = 1;
+            for(end++; isdigit((unsigned char)*end); end++)
+                ;
+        }
+        if(is_ident_char((unsigned char)*end) || *end == '.')
+            return NULL;
+        buf = ALLOCA_N(char, end - p + 1);
+        memcpy(buf, p, end - p);
+        buf[end - p] = '\0';
+        *value = is_float ? rb_float_new(strtod(buf, NULL)) : rb_cstr2inum(buf, 10);
+        return end;
+    }
+    if((end = scan_ident(p, &start)) == NULL)
+        return NULL;
+    if(end - start == 3 && !strncmp(start, "nil", 3))
+        *value = Qnil;
+    else if(end - start == 4 && !strncmp(start, "true", 4))
+        *value = Qtrue;
+    else if(end - start == 5 && !strncmp(start, "false", 5))
+        *value = Qfalse;
+    else
+        return NULL;
+    return end;
+}
+
+/*
+ * Sets the native form of the breakpoint's condition, or clears it if
+ * the condition isn't one that can be checked natively.
+ */
+void
+compile_condition(debug_breakpoint_t *breakpoint)
+{
+    const char *p, *name, *name_end;
+    VALUE value = Qnil;
+    ID op;
+    int ivar;
+
+    breakpoint->cond_op = 0;
+    breakpoint->cond_id = 0;
+    breakpoint->cond_value = Qnil;
+    if(NIL_P(breakpoint->expr))
+        return;
+
+    p = skip_space(RSTRING_PTR(breakpoint->expr));
+    ivar = (*p == '@');
+    if((name_end = scan_ident(p + ivar, &name)) == NULL ||
+       is_keyword(name, name_end - name) ||
+       *name_end == '?' || *name_end == '!' || *name_end == '(')
+        return;
+    if(!ivar && !islower((unsigned char)*name) && *name != '_')
+        return; /* a constant */
+    name -= ivar;
+    p = name_end;
+    if(!strncmp(p, ".nil?", 5))
+    {
+        op = idNilP;
+        p += 5;
+    }
+    else
+    {
+        p = skip_space(p);
+        if(!strncmp(p, "==", 2)) { op = idEq; p += 2; }
+        else if(!strncmp(p, "!=", 2)) { op = idNeq; p += 2; }
+        else if(!strncmp(p, "<=", 2)) { op = idLe; p += 2; }
+        else if(!strncmp(p, ">=", 2)) { op = idGe; p += 2; }
+        else if(*p == '<') { op = idLt; p++; }
+        else if(*p == '>') { op = idGt; p++; }
+        else
+            return;
+        if(*p == '=' || *p == '~' || *p == '<' || *p == '>')
+            return;
+        if((p = scan_literal(skip_space(p), &value)) == NULL)
+            return;
+    }
+    if(*skip_space(p) != '\0')
+        return;
+
+    breakpoint->cond_op = op;
+    breakpoint->cond_id = rb_intern2(name, name_end - name);
+    breakpoint->cond_value = value;
+}
+
+static VALUE
+call_operator(VALUE args)
+{
+    VALUE *argv = RARRAY_PTR(args);
+    return rb_funcall2(argv[0], SYM2ID(argv[1]), 1, argv + 2);
+}
+
+/*
+ * Checks the native form of the breakpoint's condition in frame +cfp+.
+ * Returns 0 if it can't, in which case the condition is evaluated in
+ * Ruby, else 1 with the outcome in *result.
+ */
+int
+check_native_condition(debug_breakpoint_t *breakpoint, rb_control_frame_t *cfp,
+    int *result)
+{
+    VALUE value, literal = breakpoint->cond_value;
+    ID op = breakpoint->cond_op;
+    int state;
+
+    if(op == 0)
+        return 0;
+    if(rb_is_instance_id(breakpoint->cond_id))
+        value = rb_ivar_defined(cfp->self, breakpoint->cond_id) ?
+            rb_ivar_get(cfp->self, breakpoint->cond_id) : Qnil;
+    else if(!frame_local(cfp, breakpoint->cond_id, &value))
+        return 0;
+
+    if(op == idNilP)
+        *result = NIL_P(value);
+    else if(FIXNUM_P(value) && FIXNUM_P(literal))
+    {
+        long a = FIX2LONG(value), b = FIX2LONG(literal);
+        *result = op == idEq ? a == b : op == idNeq ? a != b :
+                  op == idLt ? a < b  : op == idGt  ? a > b  :
+                  op == idLe ? a <= b : a >= b;
+    }
+    else if(SPECIAL_CONST_P(value) && SPECIAL_CONST_P(literal) &&
+            TYPE(value) != T_FLOAT && TYPE(literal) != T_FLOAT &&
+            (op == idEq || op == idNeq))
+        /* nil, true, false, symbols and fixnums are equal only to themselves */
+        *result = (value == literal) == (op == idEq);
+    else
+    {
+        /* other objects get their own operator, as eval would call */
+        VALUE outcome = rb_protect(call_operator,
+            rb_ary_new3(3, value, ID2SYM(op), literal), &state);
+        if(state)
+        {
+            rb_set_errinfo(Qnil);
+            outcome = Qnil;
+        }
+        *result = RTEST(outcome);
+    }
+    return 1;
+}
+
+void
+Init_condition()
+{
+    idEq = rb_intern("==");
+    idNeq = rb_intern("!=");
+    idLt = rb_intern("<");
+    idGt = rb_intern(">");
+    idLe = rb_intern("<=");
+    idGe = rb_intern(">=");
+    idNilP = rb_intern("nil?");
+}
@@ -0,0 +1,200 @@
+#include <ruby.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vm_core.h>
+#include <iseq.h>
+#include "ruby_debug.h"
+
+/*
+ * The exception profiler. While it runs, every exception raised is
+ * counted by its class and the file and line that raised it. Unless
+ * the debugger is on as well, nothing else is done: no frames are
+ * saved, no lock is taken and no catch table is touched, so code that
+ * uses exceptions for control flow can be measured at close to its
+ * normal speed.
+ */
+
+typedef struct {
+    VALUE klass;
+    char *file;
+    int line;
+    unsigned long count;
+} exception_site_t;
+
+int exception_profiling = 0;
+
+static st_table *sites = NULL;  /* exception_site_t -> itself */
+static VALUE sites_holder = Qnil; /* marks the classes in sites */
+
+static int
+site_compare(st_data_t a, st_data_t b)
+{
+    exception_site_t *x = (exception_site_t *)a, *y = (exception_site_t *)b;
+
+    if(x->klass != y->klass || x->line != y->line)
+        return 1;
+    return strcmp(x->file, y->file) != 0;
+}
+
+static st_index_t
+site_hash(st_data_t a)
+{
+    exception_site_t *site = (exception_site_t *)a;
+    const char *p;
+    st_index_t hash = (st_index_t)site->klass ^ ((st_index_t)site->line * 31);
+
+    for(p = site->file; *p; p++)
+        hash = hash * 33 + (unsigned char)*p;
+    return hash;
+}
+
+static const struct st_hash_type site_hash_type = {
+    site_compare,
+    site_hash,
+};
+
+static int
+site_mark_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    rb_gc_mark(((exception_site_t *)key)->klass);
+    return ST_CONTINUE;
+}
+
+static void
+sites_mark(void *data)
+{
+    st_foreach(sites, site_mark_i, 0);
+}
+
+static int
+site_free_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    exception_site_t *site = (exception_site_t *)key;
+
+    xfree(site->file);
+    xfree(site);
+    return ST_DELETE;
+}
+
+/*
+ * Counts the exception being raised in the current thread. Called from
+ * the event hook on RUBY_EVENT_RAISE.
+ */
+void
+profile_exception()
+{
+    exception_site_t key, *site;
+    st_data_t found;
+    const char *file = rb_sourcefile();
+
+    key.klass = rb_obj_class(rb_errinfo());
+    key.file = (char *)(file ? file : "");
+    key.line = rb_sourceline();
+    if(st_lookup(sites, (st_data_t)&key, &found))
+    {
+        ((exception_site_t *)found)->count++;
+        return;
+    }
+    site = ALLOC(exception_site_t);
+    site->klass = key.klass;
+    site->file = ALLOC_N(char, strlen(key.file) + 1);
+    strcpy(site->file, key.file);
+    site->line = key.line;
+    site->count = 1;
+    st_insert(sites, (st_data_t)site, (st_data_t)site);
+}
+
+/*
+ *   call-seq:
+ *      Debugger.exception_profile_start -> true
+ *
+ *   Starts counting the exceptions raised, by class and raising site,
+ *   dropping any counts kept. Counting doesn't change what the
+ *   debugger does with them, if it is on.
+ */
+static VALUE
+debug_exception_profile_start(VALUE self)
+{
+    st_foreach(sites, site_free_i, 0);
+    exception_profiling = 1;
+    rdebug_install_hook();
+    return Qtrue;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.exception_profile_stop -> nil
+ *
+ *   Stops counting exceptions, removing the event hook if the debugger
+ *   is off. The counts are kept until the profiler is started again.
+ */
+static VALUE
+debug_exception_profile_stop(VALUE self)
+{
+    exception_profiling = 0;
+    rdebug_release_hook();
+    return Qnil;
+}
+
+static int
+site_collect_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    exception_site_t ***next = (exception_site_t ***)arg;
+
+    *(*next)++ = (exception_site_t *)key;
+    return ST_CONTINUE;
+}
+
+static int
+site_count_compare(const void *a, const void *b)
+{
+    unsigned long x = (*(exception_site_t **)a)->count;
+    unsigned long y = (*(exception_site_t **)b)->count;
+
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.exception_profile -> array
+ *
+ *   Returns the exceptions counted by the profiler as hashes with keys
+ *   :class, :file, :line and :count, the most frequent first.
+ */
+static VALUE
+debug_exception_profile(VALUE self)
+{
+    VALUE result = rb_ary_new();
+    exception_site_t **list, **next;
+    int i, n = (int)sites->num_entries;
+
+    list = next = ALLOC_N(exception_site_t *, n + 1);
+    st_foreach(sites, site_collect_i, (st_data_t)&next);
+    qsort(list, n, sizeof(exception_site_t *), site_count_compare);
+    for(i = 0; i < n; i++)
+    {
+        VALUE hash = rb_hash_new();
+
+        rb_hash_aset(hash, ID2SYM(rb_intern("class")), list[i]->klass);
+        rb_hash_aset(hash, ID2SYM(rb_intern("file")), rb_str_new2(list[i]->file));
+        rb_hash_aset(hash, ID2SYM(rb_intern("line")), INT2FIX(list[i]->line));
+        rb_hash_aset(hash, ID2SYM(rb_intern("count")), ULONG2NUM(list[i]->count));
+        rb_ary_push(result, hash);
+    }
+    xfree(list);
+    return result;
+}
+
+void
+Init_exception_profile()
+{
+    rb_define_module_function(mDebugger, "exception_profile_start",
+        debug_exception_profile_start, 0);
+    rb_define_module_function(mDebugger, "exception_profile_stop",
+        debug_exception_profile_stop, 0);
+    rb_define_module_function(mDebugger, "exception_profile",
+        debug_exception_profile, 0);
+    sites = st_init_table(&site_hash_type);
+    sites_holder = Data_Wrap_Struct(rb_cObject, sites_mark, 0, 0);
+    rb_global_variable(&sites_holder);
+}
@@ -29,6 +29,17 @@ SRC
 }
 
 dir_config("ruby")
+have_header("unistd.h")
+have_header("sys/mman.h")
+have_header("sys/time.h")
+have_struct_member("struct stat", "st_mtim", "sys/stat.h")
+have_header("pthread.h")
+have_library("rt", "clock_gettime")
+have_func("clock_gettime", "time.h")
+have_func("rb_objspace_each_objects")
+have_func("rb_gc_count")
+have_func("posix_memalign", "stdlib.h")
+have_struct_member("rb_data_type_t", "function", "ruby.h")
 if !Ruby_core_source::create_makefile_with_core(hdrs, "ruby_debug")
   STDERR.print("Makefile creation failed\n")
   STDERR.print("*************************************************************\n\n")
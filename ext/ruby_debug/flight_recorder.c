@@ -0,0 +1,184 @@
+#include <ruby.h>
+#include <vm_core.h>
+#include <iseq.h>
+#include "ruby_debug.h"
+
+/*
+ * The flight recorder. While it is on, each line and call event of a
+ * thread is appended to a ring buffer kept in the thread's context:
+ * the iseq, line, frame depth and time. Nothing is turned into Ruby
+ * objects until the history is asked for, so it is cheap enough to
+ * leave on and tells how a thread got to where it stopped or crashed.
+ */
+
+typedef struct {
+    VALUE iseq;     /* iseq->self, to find the file and method */
+    int line;
+    int depth;      /* frames on the stack */
+    int call;       /* a call event rather than a line event */
+    double time;
+} flight_entry_t;
+
+struct flight_ring {
+    int size;
+    int next;       /* where the next entry goes */
+    int count;      /* entries recorded, up to size */
+    flight_entry_t entries[1];
+};
+
+int flight_size = 0;  /* entries per thread; 0 when the recorder is off */
+
+static ID id_line, id_call;
+
+static flight_ring_t *
+flight_ring_new(int size)
+{
+    flight_ring_t *ring;
+
+    ring = (flight_ring_t *)xmalloc(sizeof(flight_ring_t) +
+        (size - 1) * sizeof(flight_entry_t));
+    ring->size = size;
+    ring->next = 0;
+    ring->count = 0;
+    return ring;
+}
+
+/*
+ * Records a line or call event of the thread of +debug_context+, which
+ * is running +th+. Called from the event hook.
+ */
+void
+flight_record(debug_context_t *debug_context, rb_thread_t *th, rb_event_flag_t event)
+{
+    flight_ring_t *ring = debug_context->flight;
+    flight_entry_t *entry;
+
+    if (ring == NULL || ring->size != flight_size)
+    {
+        if (ring != NULL)
+            xfree(ring);
+        ring = debug_context->flight = flight_ring_new(flight_size);
+    }
+    entry = &ring->entries[ring->next];
+    entry->iseq = th->cfp->iseq->self;
+    entry->line = rb_sourceline();
+    entry->depth = (int)(RUBY_VM_END_CONTROL_FRAME(th) - th->cfp);
+    entry->call = (event == RUBY_EVENT_CALL);
+    entry->time = wall_clock();
+    if (++ring->next == ring->size)
+        ring->next = 0;
+    if (ring->count < ring->size)
+        ring->count++;
+}
+
+void
+flight_mark(flight_ring_t *ring)
+{
+    int i;
+
+    if (ring == NULL)
+        return;
+    for (i = 0; i < ring->count; i++)
+        rb_gc_mark(ring->entries[i].iseq);
+}
+
+void
+flight_free(flight_ring_t *ring)
+{
+    if (ring != NULL)
+        xfree(ring);
+}
+
+size_t
+flight_memsize(const flight_ring_t *ring)
+{
+    if (ring == NULL)
+        return 0;
+    return sizeof(flight_ring_t) + (ring->size - 1) * sizeof(flight_entry_t);
+}
+
+/*
+ *   call-seq:
+ *      context.history(count = nil) -> array
+ *
+ *   Returns the last +count+ events, or all of them, recorded for the
+ *   thread by the flight recorder, oldest first, as hashes with keys
+ *   :event (:line or :call), :file, :line, :method, :depth (frames on
+ *   the stack) and :time (seconds, from a monotonic clock where there
+ *   is one).
+ */
+VALUE
+context_history(int argc, VALUE *argv, VALUE self)
+{
+    debug_context_t *debug_context;
+    flight_ring_t *ring;
+    VALUE count, result = rb_ary_new();
+    int i, n;
+
+    rb_scan_args(argc, argv, "01", &count);
+    Data_Get_Struct(self, debug_context_t, debug_context);
+    ring = debug_context->flight;
+    if (ring == NULL)
+        return result;
+    n = ring->count;
+    if (!NIL_P(count) && NUM2INT(count) < n)
+        n = NUM2INT(count) > 0 ? NUM2INT(count) : 0;
+    for (i = ring->next - n; i < ring->next; i++)
+    {
+        flight_entry_t *entry = &ring->entries[(i + ring->size) % ring->size];
+        rb_iseq_t *iseq;
+        VALUE hash = rb_hash_new();
+
+        GetISeqPtr(entry->iseq, iseq);
+        rb_hash_aset(hash, ID2SYM(rb_intern("event")), ID2SYM(entry->call ? id_call : id_line));
+        rb_hash_aset(hash, ID2SYM(rb_intern("file")), iseq->filename);
+        rb_hash_aset(hash, ID2SYM(rb_intern("line")), INT2FIX(entry->line));
+        rb_hash_aset(hash, ID2SYM(rb_intern("method")), iseq->name);
+        rb_hash_aset(hash, ID2SYM(rb_intern("depth")), INT2FIX(entry->depth));
+        rb_hash_aset(hash, ID2SYM(rb_intern("time")), rb_float_new(entry->time));
+        rb_ary_push(result, hash);
+    }
+    return result;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.flight_recorder -> int or nil
+ *
+ *   Returns the number of events the flight recorder keeps for each
+ *   thread, nil if it is off.
+ */
+static VALUE
+debug_flight_recorder(VALUE self)
+{
+    return flight_size > 0 ? INT2FIX(flight_size) : Qnil;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.flight_recorder = int or nil
+ *
+ *   Turns the flight recorder on, keeping the last +int+ line and call
+ *   events of each thread while the debugger runs, or off with nil.
+ *   What was recorded is kept when it is turned off; see
+ *   Context#history.
+ */
+static VALUE
+debug_set_flight_recorder(VALUE self, VALUE value)
+{
+    int size = NIL_P(value) ? 0 : NUM2INT(value);
+
+    if (size < 0)
+        rb_raise(rb_eArgError, "flight recorder size must not be negative");
+    flight_size = size;
+    return value;
+}
+
+void
+Init_flight_recorder()
+{
+    rb_define_module_function(mDebugger, "flight_recorder", debug_flight_recorder, 0);
+    rb_define_module_function(mDebugger, "flight_recorder=", debug_set_flight_recorder, 1);
+    id_line = rb_intern("line");
+    id_call = rb_intern("call");
+}
@@ -0,0 +1,284 @@
+#include <ruby.h>
+#include <stdio.h>
+#include <time.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#include <vm_core.h>
+#include <iseq.h>
+#include "ruby_debug.h"
+
+/*
+ * The CPU governor. When a budget is set, the event hook measures the
+ * CPU time it spends, leaving out the time a thread is stopped at the
+ * debugger prompt, and the time spent on each breakpoint's condition
+ * and action and on tracing. Every window, GOVERNOR_WINDOW seconds
+ * unless Debugger.cpu_budget_window says otherwise, the share
+ * of the window spent in the hook is compared with the budget; if it
+ * is over, the most expensive feature is degraded: a breakpoint is
+ * sampled (only one hit in 2, 4, ... is looked at) and, once sampling
+ * reaches GOVERNOR_MAX_SAMPLE, disabled; tracing is turned off.
+ */
+
+#define GOVERNOR_WINDOW     1.0
+#define GOVERNOR_MAX_SAMPLE 16
+
+int governor_on = 0;
+
+static double budget = 0.0;
+static double window = GOVERNOR_WINDOW;
+static double window_start = 0.0;
+static double window_used = 0.0;
+static double tracing_cost = 0.0;
+static double total_used = 0.0;
+static double last_usage = 0.0;
+static unsigned long events = 0;
+static VALUE degraded = Qnil;
+
+/* Wall clock time, in seconds, used for the window. */
+double
+wall_clock()
+{
+#if defined HAVE_CLOCK_GETTIME && defined CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if(clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+#ifdef HAVE_SYS_TIME_H
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return tv.tv_sec + tv.tv_usec / 1e6;
+    }
+#else
+    return (double)time(NULL);
+#endif
+}
+
+/*
+ * CPU time of the current thread, in seconds, where the platform
+ * provides it, so time a thread spends waiting for the debugger lock
+ * isn't counted. Falls back to the wall clock.
+ */
+double
+governor_clock()
+{
+#if defined HAVE_CLOCK_GETTIME && defined CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+    return wall_clock();
+}
+
+static void
+governor_report(const char *format, int id, int value)
+{
+    char message[64];
+
+    snprintf(message, sizeof(message), format, id, value);
+    rb_ary_push(degraded, rb_str_new2(message));
+}
+
+/* Degrades the feature that cost the most in the window just ended. */
+static void
+governor_degrade()
+{
+    debug_breakpoint_t *debug_breakpoint, *worst = NULL;
+    VALUE breakpoint;
+    int i;
+
+    for(i = 0; i < RARRAY_LEN(rdebug_breakpoints); i++)
+    {
+        breakpoint = rb_ary_entry(rdebug_breakpoints, i);
+        Data_Get_Struct(breakpoint, debug_breakpoint_t, debug_breakpoint);
+        if(debug_breakpoint->enabled == Qtrue && debug_breakpoint->cost > 0 &&
+           (worst == NULL || debug_breakpoint->cost > worst->cost))
+            worst = debug_breakpoint;
+    }
+
+    if(tracing_cost > 0 && (worst == NULL || tracing_cost > worst->cost))
+    {
+        rdebug_stop_tracing();
+        rb_ary_push(degraded, rb_str_new2("tracing turned off"));
+    }
+    else if(worst == NULL)
+        return;
+    else if(worst->sample < GOVERNOR_MAX_SAMPLE)
+    {
+        worst->sample = worst->sample > 1 ? worst->sample * 2 : 2;
+        governor_report("breakpoint %d sampled 1 hit in %d", worst->id, worst->sample);
+    }
+    else
+    {
+        worst->enabled = Qfalse;
+        governor_report("breakpoint %d disabled", worst->id, 0);
+    }
+}
+
+static void
+governor_new_window(double now)
+{
+    debug_breakpoint_t *debug_breakpoint;
+    int i;
+
+    for(i = 0; i < RARRAY_LEN(rdebug_breakpoints); i++)
+    {
+        Data_Get_Struct(rb_ary_entry(rdebug_breakpoints, i), debug_breakpoint_t,
+            debug_breakpoint);
+        debug_breakpoint->cost = 0;
+    }
+    tracing_cost = 0;
+    window_used = 0;
+    window_start = now;
+}
+
+/*
+ * Accounts for one run of the event hook that started at +start+ (per
+ * governor_clock) and spent +paused+ seconds stopped at the prompt.
+ */
+void
+governor_charge(double start, double paused)
+{
+    double used = governor_clock() - start - paused;
+    double now;
+
+    events++;
+    if(used > 0)
+    {
+        window_used += used;
+        total_used += used;
+    }
+    now = wall_clock();
+    if(now - window_start < window)
+        return;
+    last_usage = window_used / (now - window_start);
+    if(last_usage > budget)
+        governor_degrade();
+    governor_new_window(now);
+}
+
+void
+governor_charge_breakpoint(debug_breakpoint_t *debug_breakpoint, double start)
+{
+    debug_breakpoint->cost += governor_clock() - start;
+}
+
+void
+governor_charge_tracing(double start)
+{
+    tracing_cost += governor_clock() - start;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.cpu_budget -> float or nil
+ *
+ *   Returns the share of CPU time the debugger may use, nil if there
+ *   is no limit.
+ */
+static VALUE
+debug_cpu_budget(VALUE self)
+{
+    return governor_on ? rb_float_new(budget) : Qnil;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.cpu_budget = float or nil
+ *
+ *   Sets the share of CPU time, for example 0.02 for 2%, the event
+ *   hook may use. When it uses more, the most expensive breakpoints are
+ *   sampled and then disabled, or tracing is turned off; see
+ *   Debugger.stats. With nil there is no limit and the hook isn't
+ *   timed.
+ */
+static VALUE
+debug_set_cpu_budget(VALUE self, VALUE value)
+{
+    if(NIL_P(value))
+    {
+        governor_on = 0;
+        return value;
+    }
+    budget = NUM2DBL(value);
+    if(budget <= 0)
+        rb_raise(rb_eArgError, "CPU budget must be positive");
+    if(!governor_on)
+    {
+        governor_new_window(wall_clock());
+        last_usage = 0;
+    }
+    governor_on = 1;
+    return value;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.cpu_budget_window -> float
+ *
+ *   Returns how many seconds the CPU governor measures over before
+ *   comparing the hook's use with the budget.
+ */
+static VALUE
+debug_cpu_budget_window(VALUE self)
+{
+    return rb_float_new(window);
+}
+
+/*
+ *   call-seq:
+ *      Debugger.cpu_budget_window = float or nil
+ *
+ *   Sets how many seconds the CPU governor measures over, by default 1.
+ *   A shorter window reacts sooner but judges on fewer events. The
+ *   window under way restarts.
+ */
+static VALUE
+debug_set_cpu_budget_window(VALUE self, VALUE value)
+{
+    double seconds = NIL_P(value) ? GOVERNOR_WINDOW : NUM2DBL(value);
+
+    if(seconds <= 0)
+        rb_raise(rb_eArgError, "CPU budget window must be positive");
+    window = seconds;
+    governor_new_window(wall_clock());
+    return value;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.stats -> hash
+ *
+ *   Returns what the CPU governor has measured: :cpu_budget, :usage
+ *   (share of CPU used by the hook in the last full window), :hook_time
+ *   (total CPU seconds), :events (hook calls timed) and :degraded, a
+ *   list of the actions the governor took.
+ */
+static VALUE
+debug_stats(VALUE self)
+{
+    VALUE hash = rb_hash_new();
+
+    rb_hash_aset(hash, ID2SYM(rb_intern("cpu_budget")), debug_cpu_budget(self));
+    rb_hash_aset(hash, ID2SYM(rb_intern("usage")), rb_float_new(last_usage));
+    rb_hash_aset(hash, ID2SYM(rb_intern("hook_time")), rb_float_new(total_used));
+    rb_hash_aset(hash, ID2SYM(rb_intern("events")), ULONG2NUM(events));
+    rb_hash_aset(hash, ID2SYM(rb_intern("degraded")), rb_ary_dup(degraded));
+    return hash;
+}
+
+void
+Init_governor()
+{
+    rb_define_module_function(mDebugger, "cpu_budget", debug_cpu_budget, 0);
+    rb_define_module_function(mDebugger, "cpu_budget=", debug_set_cpu_budget, 1);
+    rb_define_module_function(mDebugger, "cpu_budget_window", debug_cpu_budget_window, 0);
+    rb_define_module_function(mDebugger, "cpu_budget_window=", debug_set_cpu_budget_window, 1);
+    rb_define_module_function(mDebugger, "stats", debug_stats, 0);
+    degraded = rb_ary_new();
+    rb_global_variable(&degraded);
+}
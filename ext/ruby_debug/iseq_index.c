@@ -0,0 +1,551 @@
+#include <ruby.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vm_core.h>
+#include <iseq.h>
+#include <insns.inc>
+#include <insns_info.inc>
+#include "ruby_debug.h"
+
+#ifdef HAVE_RB_OBJSPACE_EACH_OBJECTS
+RUBY_EXTERN void rb_objspace_each_objects(
+    int (*callback)(void *start, void *end, size_t stride, void *data),
+    void *data); /* from gc.c */
+#endif
+
+/*
+ * Line lookups on instruction sequences. The VM's line table is
+ * ordered by position only, so finding where a line starts means
+ * scanning it. The index built here keeps two sorted copies of it,
+ * one by position and one by line, so both lookups are binary
+ * searches. Indexes are built the first time an iseq is looked at and
+ * kept in a table keyed by the iseq's address. The hook asks about the
+ * same iseq several times an event and usually again on the next one,
+ * so the last index looked up is kept aside.
+ *
+ * The iseqs in the table are marked, so none is freed, and its address
+ * given to another, while it has an index. That keeps code such as
+ * evaluated strings alive, so once the table holds ISEQ_INDEX_MAX
+ * indexes it is emptied and refilled as iseqs are looked at again.
+ */
+
+#define ISEQ_INDEX_MAX 8192
+
+static st_table *iseq_indexes = NULL;
+static VALUE iseq_indexes_holder = Qnil; /* marks the iseqs */
+static const rb_iseq_t *last_iseq = NULL;
+static iseq_index_t *last_index = NULL;
+
+/*
+ * The lines of each file a breakpoint can stop at, worked out the
+ * first time a breakpoint is put in the file and dropped along with
+ * the indexes.
+ */
+typedef struct {
+    int *lines;
+    int count;
+} file_lines_t;
+
+static st_table *file_lines = NULL;  /* file name -> file_lines_t */
+
+/*
+ * Skip paths: code in files under one of these prefixes is stepped
+ * over and its lines aren't checked for breakpoints. Whether an iseq
+ * is skipped is worked out the first time it is looked at and kept in
+ * its index's flags.
+ */
+#define ISEQ_FL_SKIP_KNOWN (1<<0)
+#define ISEQ_FL_SKIPPED    (1<<1)
+
+/* Whether line tracing passes over an iseq, see trace_filter.c. */
+#define ISEQ_FL_TRACE_KNOWN (1<<2)
+#define ISEQ_FL_UNTRACED    (1<<3)
+
+/* Whether an iseq is in the program being debugged, see iseq_in_program. */
+#define ISEQ_FL_PROGRAM_KNOWN (1<<4)
+#define ISEQ_FL_PROGRAM       (1<<5)
+
+static ID id_program_file;
+
+int   rdebug_skip_path_count = 0;
+static VALUE skip_paths = Qnil;
+
+static int
+pos_entry_cmp(const void *a, const void *b)
+{
+    const iseq_pos_entry_t *x = a, *y = b;
+    if(x->line != y->line)
+        return x->line < y->line ? -1 : 1;
+    if(x->position != y->position)
+        return x->position < y->position ? -1 : 1;
+    return 0;
+}
+
+static iseq_index_t *
+iseq_index_build(const rb_iseq_t *iseq)
+{
+    iseq_index_t *index;
+    int i, n;
+
+    n = (int)iseq->line_info_size;
+    index = ALLOC(iseq_index_t);
+    index->iseq = iseq->self;
+    index->size = n;
+    index->flags = 0;
+    index->by_pos = ALLOC_N(iseq_pos_entry_t, n > 0 ? n : 1);
+    index->by_line = ALLOC_N(iseq_pos_entry_t, n > 0 ? n : 1);
+    for(i = 0; i < n; i++)
+    {
+        index->by_pos[i].position = iseq->line_info_table[i].position;
+        index->by_pos[i].line = iseq->line_info_table[i].line_no;
+        /* first position of the run of entries on the same line */
+        if(i > 0 && index->by_pos[i].line == index->by_pos[i - 1].line)
+            index->by_pos[i].start = index->by_pos[i - 1].start;
+        else
+            index->by_pos[i].start = index->by_pos[i].position;
+    }
+    memcpy(index->by_line, index->by_pos, n * sizeof(iseq_pos_entry_t));
+    qsort(index->by_line, n, sizeof(iseq_pos_entry_t), pos_entry_cmp);
+    return index;
+}
+
+static void
+iseq_index_free(iseq_index_t *index)
+{
+    xfree(index->by_pos);
+    xfree(index->by_line);
+    xfree(index);
+}
+
+/*
+ * Returns the index of +iseq+, building it if needed. Once the table
+ * is full, it is emptied first.
+ */
+iseq_index_t *
+iseq_index_get(const rb_iseq_t *iseq)
+{
+    iseq_index_t *index;
+
+    if(iseq == NULL)
+        return NULL;
+    if(iseq == last_iseq)
+        return last_index;
+    if(!st_lookup(iseq_indexes, (st_data_t)iseq, (st_data_t *)&index))
+    {
+        if(iseq_indexes->num_entries >= ISEQ_INDEX_MAX)
+            iseq_index_clear();
+        index = iseq_index_build(iseq);
+        st_insert(iseq_indexes, (st_data_t)iseq, (st_data_t)index);
+    }
+    last_iseq = iseq;
+    last_index = index;
+    return index;
+}
+
+/*
+ * Returns the first position of +line+ in the iseq, or -1 if no
+ * instruction is on that line.
+ */
+int
+iseq_index_line_pos(iseq_index_t *index, int line)
+{
+    int lo = 0, hi = index->size;
+
+    while(lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if(index->by_line[mid].line < line)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo < index->size && index->by_line[lo].line == line)
+        return (int)index->by_line[lo].position;
+    return -1;
+}
+
+/* Entry covering the instruction before +pos+, or -1. */
+static int
+entry_before(iseq_index_t *index, unsigned int pos)
+{
+    int lo = 0, hi = index->size;
+
+    while(lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if(index->by_pos[mid].position < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+/*
+ * Returns the line of the instruction at +pos+, or 0 if unknown.
+ */
+int
+iseq_index_pos_line(iseq_index_t *index, unsigned int pos)
+{
+    int i = entry_before(index, pos + 1);
+    return i < 0 ? 0 : index->by_pos[i].line;
+}
+
+/*
+ * Returns the position where the line of the instruction just before
+ * +pos+ starts, which is where execution resumes to re-run the line
+ * that was interrupted at +pos+. Returns 0 if +pos+ is the first
+ * instruction.
+ */
+int
+iseq_index_prev_line_start(iseq_index_t *index, unsigned int pos)
+{
+    int i = entry_before(index, pos);
+    return i < 0 ? 0 : (int)index->by_pos[i].start;
+}
+
+/*
+ * Line numbers collected by executable_lines_i, kept sorted later. The
+ * heap walk must not allocate Ruby memory, so this uses realloc.
+ */
+typedef struct {
+    VALUE file;
+    int *lines;
+    int count;
+    int capa;
+} line_set_t;
+
+/*
+ * Adds the lines +iseq+ has a line event on: those of its trace
+ * instructions, since a line can have code but no event.
+ */
+static void
+line_set_add_iseq(line_set_t *set, const rb_iseq_t *iseq)
+{
+    const struct iseq_line_info_entry *entry = iseq->line_info_table;
+    const struct iseq_line_info_entry *end = entry + iseq->line_info_size;
+    unsigned long pos;
+
+    if(iseq->iseq == NULL || entry == end)
+        return;
+    for(pos = 0; pos < iseq->iseq_size; pos += insn_len(iseq->iseq[pos]))
+    {
+        if(iseq->iseq[pos] != BIN(trace) ||
+           !(FIX2INT(iseq->iseq[pos + 1]) & RUBY_EVENT_LINE))
+            continue;
+        while(entry + 1 < end && entry[1].position <= pos)
+            entry++;
+        if(set->count == set->capa)
+        {
+            int *lines = realloc(set->lines, (set->capa ? set->capa * 2 : 64) * sizeof(int));
+            if(lines == NULL)
+                return;
+            set->lines = lines;
+            set->capa = set->capa ? set->capa * 2 : 64;
+        }
+        set->lines[set->count++] = entry->line_no;
+    }
+}
+
+#ifdef HAVE_RB_OBJSPACE_EACH_OBJECTS
+static int
+executable_lines_i(void *vstart, void *vend, size_t stride, void *data)
+{
+    line_set_t *set = (line_set_t *)data;
+    VALUE v;
+    rb_iseq_t *iseq;
+
+    for(v = (VALUE)vstart; v != (VALUE)vend; v += stride)
+    {
+        if(!RBASIC(v)->flags || BUILTIN_TYPE(v) != T_DATA ||
+           RBASIC(v)->klass != rb_cISeq || !DATA_PTR(v))
+            continue;
+        GetISeqPtr(v, iseq);
+        if(iseq->filename == Qnil || TYPE(iseq->filename) != T_STRING)
+            continue;
+        if(!filename_cmp(set->file, RSTRING_PTR(iseq->filename)))
+            continue;
+        line_set_add_iseq(set, iseq);
+    }
+    return 0;
+}
+#endif
+
+static int
+int_cmp(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Sets *lines to the sorted line numbers of +file+ that have a line
+ * event in its loaded code and returns how many there are, or -1 if
+ * none of that file's code is loaded. The lines are cached; the
+ * caller doesn't free them.
+ */
+int
+executable_lines(VALUE file, int **lines)
+{
+    file_lines_t *cached;
+    line_set_t set;
+    char *name;
+    int i, n;
+
+    if(st_lookup(file_lines, (st_data_t)RSTRING_PTR(file), (st_data_t *)&cached))
+    {
+        *lines = cached->lines;
+        return cached->count;
+    }
+    set.file = file;
+    set.lines = NULL;
+    set.count = 0;
+    set.capa = 0;
+#ifdef HAVE_RB_OBJSPACE_EACH_OBJECTS
+    rb_objspace_each_objects(executable_lines_i, &set);
+#endif
+    if(set.count == 0)
+    {
+        /* not cached: the file may be loaded later */
+        free(set.lines);
+        *lines = NULL;
+        return -1;
+    }
+    qsort(set.lines, set.count, sizeof(int), int_cmp);
+    for(i = 1, n = 1; i < set.count; i++)
+        if(set.lines[i] != set.lines[n - 1])
+            set.lines[n++] = set.lines[i];
+    cached = ALLOC(file_lines_t);
+    cached->lines = ALLOC_N(int, n);
+    memcpy(cached->lines, set.lines, n * sizeof(int));
+    cached->count = n;
+    free(set.lines);
+    name = ALLOC_N(char, strlen(RSTRING_PTR(file)) + 1);
+    strcpy(name, RSTRING_PTR(file));
+    st_insert(file_lines, (st_data_t)name, (st_data_t)cached);
+    *lines = cached->lines;
+    return n;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.executable_lines(file) -> array or nil
+ *
+ *   Returns the sorted line numbers of +file+ that a breakpoint can
+ *   stop at, taken from the code currently loaded. Returns nil if none
+ *   of the file's code is loaded.
+ */
+static VALUE
+debug_executable_lines(VALUE self, VALUE file)
+{
+    VALUE result;
+    int *lines;
+    int i, n;
+
+    StringValue(file);
+    n = executable_lines(file, &lines);
+    if(n < 0)
+        return Qnil;
+    result = rb_ary_new2(n);
+    for(i = 0; i < n; i++)
+        rb_ary_push(result, INT2FIX(lines[i]));
+    return result;
+}
+
+static int
+path_skipped(VALUE filename)
+{
+    VALUE prefix;
+    int i;
+
+    if(TYPE(filename) != T_STRING)
+        return 0;
+    for(i = 0; i < RARRAY_LEN(skip_paths); i++)
+    {
+        prefix = RARRAY_PTR(skip_paths)[i];
+        if(RSTRING_LEN(filename) >= RSTRING_LEN(prefix) &&
+           !memcmp(RSTRING_PTR(filename), RSTRING_PTR(prefix), RSTRING_LEN(prefix)))
+            return 1;
+    }
+    return 0;
+}
+
+/* Returns true if +iseq+ is in a file under a skip path. */
+int
+iseq_skipped(const rb_iseq_t *iseq)
+{
+    iseq_index_t *index = iseq_index_get(iseq);
+
+    if(index == NULL)
+        return 0;
+    if(!(index->flags & ISEQ_FL_SKIP_KNOWN))
+    {
+        index->flags |= ISEQ_FL_SKIP_KNOWN;
+        if(path_skipped(iseq->filename))
+            index->flags |= ISEQ_FL_SKIPPED;
+    }
+    return index->flags & ISEQ_FL_SKIPPED;
+}
+
+static int
+iseq_index_forget_skip_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    ((iseq_index_t *)value)->flags &= ~(ISEQ_FL_SKIP_KNOWN | ISEQ_FL_SKIPPED);
+    return ST_CONTINUE;
+}
+
+/* Returns true if lines of +iseq+ pass the trace filters. */
+int
+iseq_traced(const rb_iseq_t *iseq)
+{
+    iseq_index_t *index = iseq_index_get(iseq);
+
+    if(index == NULL)
+        return 1;
+    if(!(index->flags & ISEQ_FL_TRACE_KNOWN))
+    {
+        index->flags |= ISEQ_FL_TRACE_KNOWN;
+        if(!trace_filter_match(iseq))
+            index->flags |= ISEQ_FL_UNTRACED;
+    }
+    return !(index->flags & ISEQ_FL_UNTRACED);
+}
+
+static int
+iseq_index_forget_traced_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    ((iseq_index_t *)value)->flags &= ~(ISEQ_FL_TRACE_KNOWN | ISEQ_FL_UNTRACED);
+    return ST_CONTINUE;
+}
+
+/*
+ * Returns true if +iseq+ is in the file of the program being debugged,
+ * as Debugger.program_file? tells, or if that isn't defined. Line
+ * tracing to a trace file starts there, as Context#at_tracing does.
+ */
+int
+iseq_in_program(const rb_iseq_t *iseq)
+{
+    iseq_index_t *index = iseq_index_get(iseq);
+
+    if(index == NULL)
+        return 0;
+    if(!(index->flags & ISEQ_FL_PROGRAM_KNOWN))
+    {
+        index->flags |= ISEQ_FL_PROGRAM_KNOWN;
+        if(!rb_respond_to(mDebugger, id_program_file) ||
+           RTEST(rb_funcall(mDebugger, id_program_file, 1, iseq->filename)))
+            index->flags |= ISEQ_FL_PROGRAM;
+    }
+    return index->flags & ISEQ_FL_PROGRAM;
+}
+
+/* Forgets which iseqs are traced, for when the trace filters change. */
+void
+iseq_index_forget_traced()
+{
+    st_foreach(iseq_indexes, iseq_index_forget_traced_i, 0);
+}
+
+/*
+ *   call-seq:
+ *      Debugger.skip_paths -> array
+ *
+ *   Returns the path prefixes of the code that is skipped.
+ */
+static VALUE
+debug_skip_paths(VALUE self)
+{
+    return rb_ary_dup(skip_paths);
+}
+
+/*
+ *   call-seq:
+ *      Debugger.skip_paths = array
+ *
+ *   Sets the path prefixes of the code to skip: stepping doesn't stop
+ *   in a file whose name starts with one of them, and breakpoints,
+ *   logpoints and snapshot points on its lines are ignored. Method
+ *   breakpoints still stop. File names are compared as the VM has
+ *   them, so prefixes are usually absolute.
+ */
+static VALUE
+debug_set_skip_paths(VALUE self, VALUE paths)
+{
+    VALUE copy = rb_ary_new();
+    int i;
+
+    if(!NIL_P(paths))
+    {
+        paths = rb_Array(paths);
+        for(i = 0; i < RARRAY_LEN(paths); i++)
+        {
+            VALUE path = RARRAY_PTR(paths)[i];
+            StringValue(path);
+            rb_ary_push(copy, rb_obj_freeze(rb_str_dup(path)));
+        }
+    }
+    skip_paths = copy;
+    rdebug_skip_path_count = (int)RARRAY_LEN(copy);
+    st_foreach(iseq_indexes, iseq_index_forget_skip_i, 0);
+    return paths;
+}
+
+static int
+iseq_index_mark_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    rb_gc_mark(((iseq_index_t *)value)->iseq);
+    return ST_CONTINUE;
+}
+
+static void
+iseq_indexes_mark(void *data)
+{
+    st_foreach(iseq_indexes, iseq_index_mark_i, 0);
+}
+
+static int
+iseq_index_free_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    iseq_index_free((iseq_index_t *)value);
+    return ST_DELETE;
+}
+
+static int
+file_lines_free_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    xfree((char *)key);
+    xfree(((file_lines_t *)value)->lines);
+    xfree((file_lines_t *)value);
+    return ST_DELETE;
+}
+
+/*
+ * Drops every index and line cache, for when the debugger stops or the
+ * index table is full.
+ */
+void
+iseq_index_clear()
+{
+    last_iseq = NULL;
+    last_index = NULL;
+    st_foreach(iseq_indexes, iseq_index_free_i, 0);
+    st_foreach(file_lines, file_lines_free_i, 0);
+}
+
+void
+Init_iseq_index()
+{
+    rb_define_module_function(mDebugger, "executable_lines",
+        debug_executable_lines, 1);
+    rb_define_module_function(mDebugger, "skip_paths", debug_skip_paths, 0);
+    rb_define_module_function(mDebugger, "skip_paths=", debug_set_skip_paths, 1);
+    iseq_indexes = st_init_numtable();
+    file_lines = st_init_strtable();
+    id_program_file = rb_intern("program_file?");
+    skip_paths = rb_ary_new();
+    rb_global_variable(&skip_paths);
+    iseq_indexes_holder = Data_Wrap_Struct(rb_cObject, iseq_indexes_mark, 0, 0);
+    rb_global_variable(&iseq_indexes_holder);
+}
@@ -33,16 +33,27 @@ typedef struct {
 } threads_table_t;
 
 static VALUE hook_off           = Qtrue;
+static int   hook_installed     = 0;
 static VALUE tracing            = Qfalse;
 static VALUE locker             = Qnil;
 static VALUE debug_flag         = Qfalse;
 static VALUE catchall           = Qtrue;
 static VALUE skip_next_exception= Qfalse;
+static VALUE debugging_default  = Qtrue;
+static int   debugging_filtered = 0; /* some thread may have debugging off */
+static int   debugging_changes  = 0; /* bumped when debugging is turned on or off */
+
+static VALUE thread_listener = Qnil; /* see debug_on_thread_event */
 
 static VALUE last_context = Qnil;
 static VALUE last_thread  = Qnil;
 static debug_context_t *last_debug_context = NULL;
 
+static debug_catcher_t *unused_catchers = NULL;
+static VALUE catcher_name     = Qnil;
+static VALUE catch_iseq       = Qnil; /* see compile_catch_iseq */
+static VALUE catcher_mark_ary = Qnil;
+
 VALUE rdebug_threads_tbl = Qnil; /* Context for each of the threads */
 VALUE mDebugger;                 /* Ruby Debugger Module object */
 
@@ -60,6 +71,7 @@ static ID idAtCatchpoint;
 static ID idAtLine;
 static ID idAtReturn;
 static ID idAtTracing;
+static ID idCall;
 static ID idList;
 static ID id_binding_n;
 static ID id_frame_binding;
@@ -125,7 +137,7 @@ debug_runtime_error(debug_context_t *debug_context, const char *err)
 inline static void
 reset_stepping_stop_points(debug_context_t *debug_context)
 {
-    debug_context->dest_frame = -1;
+    debug_context->dest_cfp   = NULL;
     debug_context->stop_line  = -1;
     debug_context->stop_next  = -1;
 }
@@ -228,6 +240,58 @@ remove_from_locked(void)
     return thread;
 }
 
+/*
+ * Thread events. A context is created when its thread first reaches
+ * the hook and dropped once the thread is dead, which may be noticed
+ * while marking, so both are only noted here, in memory GC doesn't
+ * manage. The hook hands them to the thread listener on its next call.
+ */
+typedef struct {
+    int start;
+    int thnum;
+} thread_event_t;
+
+static thread_event_t *thread_events = NULL;
+static long thread_event_count = 0;
+static long thread_event_capa = 0;
+
+static void
+thread_event_note(int start, debug_context_t *debug_context)
+{
+    thread_event_t *events;
+
+    if(NIL_P(thread_listener) || CTX_FL_TEST(debug_context, CTX_FL_IGNORE))
+        return;
+    if(thread_event_count == thread_event_capa)
+    {
+        events = realloc(thread_events, (thread_event_capa * 2 + 8) * sizeof(thread_event_t));
+        if(events == NULL)
+            return;
+        thread_events = events;
+        thread_event_capa = thread_event_capa * 2 + 8;
+    }
+    thread_events[thread_event_count].start = start;
+    thread_events[thread_event_count].thnum = debug_context->thnum;
+    thread_event_count++;
+}
+
+/* Calls the thread listener with the events noted so far. */
+static void
+thread_events_deliver(void)
+{
+    thread_event_t event;
+    long i;
+
+    for(i = 0; i < thread_event_count && !NIL_P(thread_listener); i++)
+    {
+        event = thread_events[i];
+        rb_funcall(thread_listener, idCall, 2,
+                   ID2SYM(rb_intern(event.start ? "start" : "exit")),
+                   INT2FIX(event.thnum));
+    }
+    thread_event_count = 0;
+}
+
 static int is_living_thread(VALUE thread);
 
 static int
@@ -242,6 +306,7 @@ threads_table_mark_keyvalue(st_data_t key, st_data_t value, st_data_t tbl)
 	rb_gc_mark(thread);
     }
     else {
+	thread_event_note(0, (debug_context_t *)DATA_PTR((VALUE)value));
 	st_insert((st_table *)tbl, key, 0);
     }
     return ST_CONTINUE;
@@ -273,15 +338,6 @@ threads_table_create(void)
     return Data_Wrap_Struct(cThreadsTable, threads_table_mark, threads_table_free, threads_table);
 }
 
-static void
-threads_table_clear(VALUE table)
-{
-    threads_table_t *threads_table;
-
-    Data_Get_Struct(table, threads_table_t, threads_table);
-    st_clear(threads_table->tbl);
-}
-
 static int
 is_thread_alive(VALUE thread)
 {
@@ -308,6 +364,7 @@ threads_table_check_i(st_data_t key, st_data_t value, st_data_t dummy)
     thread = id2ref((VALUE)key);
     if(!is_living_thread(thread))
     {
+        thread_event_note(0, (debug_context_t *)DATA_PTR((VALUE)value));
         return ST_DELETE;
     }
     return ST_CONTINUE;
@@ -322,25 +379,94 @@ check_thread_contexts(void)
     st_foreach(threads_table->tbl, threads_table_check_i, 0);
 }
 
-static struct iseq_catch_table_entry *
-create_catch_table(debug_context_t *debug_context, unsigned long cont)
+static VALUE debug_context_create(VALUE thread);
+
+static int
+threads_table_add_i(st_data_t key, st_data_t value, st_data_t tbl)
+{
+    VALUE context;
+
+    if(!st_lookup((st_table *)tbl, key, &context) || !context)
+        st_insert((st_table *)tbl, key, debug_context_create((VALUE)key));
+    return ST_CONTINUE;
+}
+
+/*
+ * Brings the threads table up to date. Threads get their context when
+ * they first reach the event hook; this adds one for each thread that
+ * hasn't yet and, if that leaves more contexts than living threads,
+ * drops those of dead threads.
+ */
+static threads_table_t *
+threads_table_sync(void)
 {
-    struct iseq_catch_table_entry *catch_table = &debug_context->catch_table.tmp_catch_table;
+    threads_table_t *threads_table;
+    st_table *living = GET_THREAD()->vm->living_threads;
+
+    Data_Get_Struct(rdebug_threads_tbl, threads_table_t, threads_table);
+    st_foreach(living, threads_table_add_i, (st_data_t)threads_table->tbl);
+    if(threads_table->tbl->num_entries > living->num_entries)
+        check_thread_contexts();
+    return threads_table;
+}
+
+/* Returns the thread's catcher, taking or allocating one if needed. */
+static debug_catcher_t *
+catcher_get(debug_context_t *debug_context)
+{
+    debug_catcher_t *catcher = debug_context->catcher;
+
+    if (catcher != NULL)
+        return catcher;
+    if (unused_catchers != NULL)
+    {
+        catcher = unused_catchers;
+        unused_catchers = catcher->next;
+    }
+    else
+    {
+        catcher = ALLOC(debug_catcher_t);
+        catcher->catch_iseq.iseq_encoded = NULL;
+    }
+    catcher->next = NULL;
+    catcher->catch_table.mod_name = Qnil;
+    catcher->catch_table.errinfo = Qnil;
+    debug_context->catcher = catcher;
+    return catcher;
+}
+
+/*
+ * Compiles the empty iseq that catch entries made by create_catch_table
+ * point to. Done once: the iseq holds nothing of a particular catch,
+ * whose cont and sp are kept in the entry.
+ */
+static VALUE
+compile_catch_iseq(void)
+{
+    VALUE iseq;
 
     GET_THREAD()->parse_in_eval++;
     GET_THREAD()->mild_compile_error++;
     /* compiling with option Qfalse (no options) prevents debug hook calls during this catch routine
      */
 #ifdef RB_ISEQ_COMPILE_5ARGS
-    catch_table->iseq = rb_iseq_compile_with_option(
+    iseq = rb_iseq_compile_with_option(
         rb_str_new_cstr(""), rb_str_new_cstr("(exception catcher)"), Qnil, INT2FIX(1), Qfalse);
 #else
-    catch_table->iseq = rb_iseq_compile_with_option(
+    iseq = rb_iseq_compile_with_option(
         rb_str_new_cstr(""), rb_str_new_cstr("(exception catcher)"), INT2FIX(1), Qfalse);
 #endif
     GET_THREAD()->mild_compile_error--;
     GET_THREAD()->parse_in_eval--;
+    return iseq;
+}
+
+static struct iseq_catch_table_entry *
+create_catch_table(debug_context_t *debug_context, unsigned long cont)
+{
+    struct iseq_catch_table_entry *catch_table = &catcher_get(debug_context)->catch_table.tmp_catch_table;
 
+    catch_table->iseq = catch_iseq;
     catch_table->type = CATCH_TYPE_RESCUE;
     catch_table->start = 0;
     catch_table->end = ULONG_MAX;
@@ -450,6 +576,7 @@ FUNC_FASTCALL(do_catchall)(rb_thread_t *th, rb_control_frame_t *cfp)
     debug_context->cfp = (rb_control_frame_t**)malloc(size);
     memcpy(debug_context->cfp, debug_context->saved_cfp, size);
     ZFREE(debug_context->saved_cfp);
+    CTX_FL_UNSET(debug_context, CTX_FL_FRAMES_STALE);
 
     size = sizeof(rb_control_frame_t) *
         ((debug_context->cfp[debug_context->cfp_count-1] - debug_context->cfp[0]) + 1);
@@ -461,81 +588,164 @@ FUNC_FASTCALL(do_catchall)(rb_thread_t *th, rb_control_frame_t *cfp)
     return(th->cfp);
 }
 
+/* Builds the iseq of a new catcher, which calls do_catchall. */
 static void
-create_exception_catchall(debug_context_t *debug_context)
-{
+catcher_init(debug_catcher_t *catcher)
+{
+    memset(&catcher->catch_iseq, 0, sizeof(struct rb_iseq_struct));
+    memset(&catcher->catch_cref_stack, 0, sizeof(struct RNode));
+    catcher->catch_rdata.basic.flags = RUBY_T_DATA;
+    catcher->catch_rdata.basic.klass = 0;
+    catcher->catch_rdata.dmark = NULL;
+    catcher->catch_rdata.dfree = NULL;
+    catcher->catch_rdata.data = &catcher->catch_iseq;
+    catcher->catch_iseq.type = ISEQ_TYPE_RESCUE;
+    catcher->catch_iseq.name = catcher_name;
+    catcher->catch_iseq.filename = catcher_name;
+    catcher->catch_iseq.iseq = catcher->iseq_insn;
+    catcher->catch_iseq.iseq_encoded = NULL;
+    catcher->catch_iseq.iseq[0] = BIN(opt_call_c_function);
+    catcher->catch_iseq.iseq[1] = (VALUE)do_catchall;
+    catcher->catch_iseq.iseq[2] = BIN(getdynamic);
+    catcher->catch_iseq.iseq[3] = 1; /* #$!, only value in local_table */
+    catcher->catch_iseq.iseq[4] = 0;
+    catcher->catch_iseq.iseq[5] = BIN(throw);
+    catcher->catch_iseq.iseq[6] = 0;
+    catcher->catch_iseq.iseq_size = sizeof(catcher->iseq_insn) / sizeof(VALUE);
+    catcher->catch_iseq.mark_ary = catcher_mark_ary;
+    catcher->catch_iseq.line_info_table = &catcher->catch_info_entry;
+    catcher->catch_iseq.line_info_size = 1;
+    catcher->catch_iseq.local_size = 1;
+    catcher->catch_iseq.local_table = &catcher->local_table;
+    catcher->catch_iseq.local_table[0] = rb_intern("#$!");
+    catcher->catch_iseq.arg_simple = 1;
+    catcher->catch_iseq.arg_rest = -1;
+    catcher->catch_iseq.arg_block = -1;
+    catcher->catch_iseq.stack_max = 1;
+    catcher->catch_iseq.local_iseq = &catcher->catch_iseq;
+    catcher->catch_iseq.self = (VALUE)&catcher->catch_rdata;
+    catcher->catch_iseq.cref_stack = &catcher->catch_cref_stack;
+    catcher->catch_info_entry.position = 0;
+    catcher->catch_info_entry.line_no = 1;
+#if defined HAVE_TYPE_STRUCT_ISEQ_INSN_INFO_ENTRY
+    catcher->catch_info_entry.sp = 0;
+#endif
+    catcher->catch_cref_stack.flags = 1052;
+
+    rb_iseq_translate_threaded_code(&catcher->catch_iseq);
+}
+
+/*
+ * The iseqs whose catch table has had a catcher entry added, each with
+ * its original table. An iseq gets at most one entry, whichever
+ * thread's catcher it is: do_catchall works on the context of the
+ * thread that runs it. The iseqs are marked so they stay alive while
+ * patched. restore_catch_tables puts the original tables back.
+ */
+typedef struct {
     rb_iseq_t *iseq;
+    struct iseq_catch_table_entry *table;       /* the patched table */
+    struct iseq_catch_table_entry *orig_table;
+    int orig_size;
+} catch_patch_t;
+
+static st_table *catch_patches = NULL;
+static VALUE catch_patches_holder = Qnil;
+static int catch_generation = 0;   /* bumped when tables are restored */
+
+static int
+catch_patch_mark_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    rb_gc_mark(((catch_patch_t *)value)->iseq->self);
+    return ST_CONTINUE;
+}
+
+static void
+catch_patches_mark(void *data)
+{
+    st_foreach(catch_patches, catch_patch_mark_i, 0);
+}
+
+static void
+patch_catch_table(rb_iseq_t *iseq, debug_catcher_t *catcher)
+{
+    catch_patch_t *patch;
     struct iseq_catch_table_entry *entry;
-    rb_control_frame_t *cfp = GET_THREAD()->cfp;
-    while (cfp->iseq == NULL)
-        cfp = RUBY_VM_PREVIOUS_CONTROL_FRAME(cfp);
+    int size = iseq->catch_table_size;
 
-    debug_context->start_cfp = cfp;
-    if (catchall == Qfalse)
+    if (st_lookup(catch_patches, (st_data_t)iseq, 0))
         return;
 
-    iseq = cfp->iseq;
-    iseq->catch_table_size++;
-    entry = ALLOC_N(struct iseq_catch_table_entry, iseq->catch_table_size);
-
-    if (iseq->catch_table_size > 1)
-    {
-        MEMCPY(entry, iseq->catch_table, struct iseq_catch_table_entry, iseq->catch_table_size-1);
-        xfree(iseq->catch_table);
-        iseq->catch_table = entry;
-        entry += iseq->catch_table_size-1;
-    }
-    else
-        iseq->catch_table = entry;
-
-    memset(&debug_context->catch_iseq, 0, sizeof(struct rb_iseq_struct));
-    memset(&debug_context->catch_cref_stack, 0, sizeof(struct RNode));
-    debug_context->catch_rdata.basic.flags = RUBY_T_DATA;
-    debug_context->catch_rdata.basic.klass = 0;
-    debug_context->catch_rdata.dmark = NULL;
-    debug_context->catch_rdata.dfree = NULL;
-    debug_context->catch_rdata.data = &debug_context->catch_iseq;
-    debug_context->catch_iseq.type = ISEQ_TYPE_RESCUE;
-    debug_context->catch_iseq.name = rb_str_new_cstr("(exception catcher)");
-    debug_context->catch_iseq.filename = rb_str_new_cstr("(exception catcher)");
-    debug_context->catch_iseq.iseq = debug_context->iseq_insn;
-    debug_context->catch_iseq.iseq_encoded = NULL;
-    debug_context->catch_iseq.iseq[0] = BIN(opt_call_c_function);
-    debug_context->catch_iseq.iseq[1] = (VALUE)do_catchall;
-    debug_context->catch_iseq.iseq[2] = BIN(getdynamic);
-    debug_context->catch_iseq.iseq[3] = 1; /* #$!, only value in local_table */
-    debug_context->catch_iseq.iseq[4] = 0;
-    debug_context->catch_iseq.iseq[5] = BIN(throw);
-    debug_context->catch_iseq.iseq[6] = 0;
-    debug_context->catch_iseq.iseq_size = sizeof(debug_context->iseq_insn) / sizeof(VALUE);
-    debug_context->catch_iseq.mark_ary = rb_ary_new();
-    debug_context->catch_iseq.line_info_table = &debug_context->catch_info_entry;
-    debug_context->catch_iseq.line_info_size = 1;
-    debug_context->catch_iseq.local_size = 1;
-    debug_context->catch_iseq.local_table = &debug_context->local_table;
-    debug_context->catch_iseq.local_table[0] = rb_intern("#$!");
-    debug_context->catch_iseq.arg_simple = 1;
-    debug_context->catch_iseq.arg_rest = -1;
-    debug_context->catch_iseq.arg_block = -1;
-    debug_context->catch_iseq.stack_max = 1;
-    debug_context->catch_iseq.local_iseq = &debug_context->catch_iseq;
-    debug_context->catch_iseq.self = (VALUE)&debug_context->catch_rdata;
-    debug_context->catch_iseq.cref_stack = &debug_context->catch_cref_stack;
-    debug_context->catch_info_entry.position = 0;
-    debug_context->catch_info_entry.line_no = 1;
-#if defined HAVE_TYPE_STRUCT_ISEQ_INSN_INFO_ENTRY
-    debug_context->catch_info_entry.sp = 0;
-#endif
-    debug_context->catch_cref_stack.flags = 1052;
+    patch = ALLOC(catch_patch_t);
+    patch->iseq = iseq;
+    patch->orig_table = iseq->catch_table;
+    patch->orig_size = size;
+    patch->table = ALLOC_N(struct iseq_catch_table_entry, size + 1);
+    if (size > 0)
+        MEMCPY(patch->table, iseq->catch_table, struct iseq_catch_table_entry, size);
 
+    entry = patch->table + size;
     entry->type = CATCH_TYPE_RESCUE;
-    entry->iseq = debug_context->catch_iseq.self;
+    entry->iseq = catcher->catch_iseq.self;
     entry->start = 0;
     entry->end = ULONG_MAX;
     entry->cont = 0;
     entry->sp = 0;
 
-    rb_iseq_translate_threaded_code(&debug_context->catch_iseq);
+    iseq->catch_table = patch->table;
+    iseq->catch_table_size = size + 1;
+    st_insert(catch_patches, (st_data_t)iseq, (st_data_t)patch);
+}
+
+static int
+restore_catch_table_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    catch_patch_t *patch = (catch_patch_t *)value;
+
+    /* a table swapped out for a catch or jump in progress is put back
+       later by whoever swapped it; leave it for the next restore */
+    if (patch->iseq->catch_table != patch->table)
+        return ST_CONTINUE;
+    patch->iseq->catch_table = patch->orig_table;
+    patch->iseq->catch_table_size = patch->orig_size;
+    xfree(patch->table);
+    xfree(patch);
+    return ST_DELETE;
+}
+
+/*
+ * Removes the catcher entries, for when the debugger stops or catchall
+ * is turned off. Threads add them again as needed.
+ */
+static void
+restore_catch_tables(void)
+{
+    st_foreach(catch_patches, restore_catch_table_i, 0);
+    catch_generation++;
+}
+
+/*
+ * Makes exceptions raised in the thread go through do_catchall, by
+ * putting a catcher in the catch table of its outermost frame.
+ */
+static void
+create_exception_catchall(debug_context_t *debug_context)
+{
+    debug_catcher_t *catcher;
+    rb_control_frame_t *cfp = GET_THREAD()->cfp;
+    while (cfp->iseq == NULL)
+        cfp = RUBY_VM_PREVIOUS_CONTROL_FRAME(cfp);
+
+    if (debug_context->start_cfp == NULL || cfp > debug_context->start_cfp)
+        debug_context->start_cfp = cfp;
+    debug_context->catch_generation = catch_generation;
+    if (catchall == Qfalse)
+        return;
+
+    catcher = catcher_get(debug_context);
+    if (catcher->catch_iseq.iseq_encoded == NULL)
+        catcher_init(catcher);
+    patch_catch_table(debug_context->start_cfp->iseq, catcher);
 }
 
 /*
@@ -548,7 +758,8 @@ create_exception_catchall(debug_context_t *debug_context)
 static VALUE
 debug_is_started(VALUE self)
 {
-    return Qtrue;
+    /* the hook may stay installed for the exception profiler or timeline */
+    return hook_off == Qfalse ? Qtrue : Qfalse;
 }
 
 static void
@@ -556,12 +767,77 @@ debug_context_mark(void *data)
 {
     debug_context_t *debug_context = (debug_context_t *)data;
     rb_gc_mark(debug_context->breakpoint);
+    rb_gc_mark(debug_context->last_exception);
+    if (debug_context->catcher != NULL)
+    {
+        rb_gc_mark(debug_context->catcher->catch_table.mod_name);
+        rb_gc_mark(debug_context->catcher->catch_table.errinfo);
+    }
+    flight_mark(debug_context->flight);
 }
 
 static void
 debug_context_free(void *data)
 {
     debug_context_t *debug_context = (debug_context_t *)data;
+
+    ZFREE(debug_context->cfp);
+    ZFREE(debug_context->saved_frames);
+    ZFREE(debug_context->saved_cfp);
+    ZFREE(debug_context->old_iseq_catch);
+    flight_free(debug_context->flight);
+    if (debug_context->catcher != NULL)
+    {
+        debug_context->catcher->next = unused_catchers;
+        unused_catchers = debug_context->catcher;
+    }
+    if (last_debug_context == debug_context)
+        last_debug_context = NULL;
+#if defined HAVE_POSIX_MEMALIGN && defined RDEBUG_CACHE_LINE
+    free(debug_context);
+#else
+    xfree(debug_context);
+#endif
+}
+
+/* Memory used by a context, for ObjectSpace.memsize_of. */
+static size_t
+debug_context_memsize(const void *data)
+{
+    const debug_context_t *debug_context = (const debug_context_t *)data;
+    size_t size = sizeof(debug_context_t);
+
+    size += debug_context->cfp_count * sizeof(rb_control_frame_t *);
+    size += debug_context->saved_cfp_count * sizeof(rb_control_frame_t *);
+    if (debug_context->saved_frames != NULL)
+        size += debug_context->saved_frame_count * sizeof(rb_control_frame_t);
+    if (debug_context->catcher != NULL)
+        size += sizeof(debug_catcher_t);
+    size += flight_memsize(debug_context->flight);
+    return size;
+}
+
+static const rb_data_type_t debug_context_data_type = {
+    "Debugger::Context",
+#ifdef HAVE_RB_DATA_TYPE_T_FUNCTION
+    {debug_context_mark, debug_context_free, debug_context_memsize,},
+#else
+    debug_context_mark, debug_context_free, debug_context_memsize,
+#endif
+};
+
+static debug_context_t *
+debug_context_alloc()
+{
+#if defined HAVE_POSIX_MEMALIGN && defined RDEBUG_CACHE_LINE
+    void *ptr;
+
+    if (posix_memalign(&ptr, RDEBUG_CACHE_LINE, sizeof(debug_context_t)) != 0)
+        rb_memerror();
+    return (debug_context_t *)ptr;
+#else
+    return ALLOC(debug_context_t);
+#endif
 }
 
 static VALUE
@@ -569,7 +845,7 @@ debug_context_create(VALUE thread)
 {
     debug_context_t *debug_context;
 
-    debug_context = ALLOC(debug_context_t);
+    debug_context = debug_context_alloc();
     debug_context-> thnum = ++thnum_max;
 
     debug_context->last_file = NULL;
@@ -577,9 +853,9 @@ debug_context_create(VALUE thread)
     debug_context->flags = 0;
 
     debug_context->stop_next = -1;
-    debug_context->dest_frame = -1;
+    debug_context->dest_cfp = NULL;
     debug_context->stop_line = -1;
-    debug_context->stop_frame = -1;
+    debug_context->stop_cfp = NULL;
     debug_context->stop_reason = CTX_STOP_NONE;
     debug_context->thread_id = ref2id(thread);
     debug_context->breakpoint = Qnil;
@@ -591,15 +867,27 @@ debug_context_create(VALUE thread)
     debug_context->cfp_count = 0;
     debug_context->start_cfp = NULL;
     debug_context->cur_cfp = NULL;
+    debug_context->frames_cfp = NULL;
     debug_context->top_cfp = NULL;
     debug_context->catch_cfp = NULL;
     debug_context->saved_frames = NULL;
+    debug_context->saved_frame_count = 0;
     debug_context->saved_cfp = NULL;
     debug_context->saved_cfp_count = 0;
     debug_context->cfp = NULL;
+    debug_context->catcher = NULL;
+    debug_context->catch_generation = 0;
+    debug_context->governor_paused = 0;
+    debug_context->flight = NULL;
+    debug_context->trace_base = 0;
+    debug_context->timeline = NULL;
+    debug_context->timeline_generation = 0;
     if(rb_obj_class(thread) == cDebugThread)
         CTX_FL_SET(debug_context, CTX_FL_IGNORE);
-    return Data_Wrap_Struct(cContext, debug_context_mark, debug_context_free, debug_context);
+    else if(!RTEST(debugging_default))
+        CTX_FL_SET(debug_context, CTX_FL_DISABLED);
+    thread_event_note(1, debug_context);
+    return TypedData_Wrap_Struct(cContext, &debug_context_data_type, debug_context);
 }
 
 static void
@@ -654,13 +942,22 @@ call_at_line_unprotected(VALUE args)
 static VALUE
 call_at_line(VALUE context, debug_context_t *debug_context, VALUE file, VALUE line)
 {
-    VALUE args;
+    VALUE args, result;
+    double start;
 
     last_debugged_thnum = debug_context->thnum;
     save_current_position(debug_context);
+    source_cache_expire();
 
     args = rb_ary_new3(3, context, file, line);
-    return(rb_protect(call_at_line_unprotected, args, 0));
+    if (!governor_on)
+        return(rb_protect(call_at_line_unprotected, args, 0));
+
+    /* the time spent at the prompt isn't the hook's */
+    start = governor_clock();
+    result = rb_protect(call_at_line_unprotected, args, 0);
+    debug_context->governor_paused += governor_clock() - start;
+    return(result);
 }
 
 #if defined DOSISH
@@ -740,7 +1037,7 @@ call_at_line_check(VALUE self, debug_context_t *debug_context, VALUE breakpoint,
     /* check breakpoint expression */
     if(breakpoint != Qnil)
     {
-        if(!check_breakpoint_expression(breakpoint, rb_binding_new()))
+        if(!check_breakpoint_expression(breakpoint, debug_context->cur_cfp))
             return;
         if(!check_breakpoint_hit_condition(breakpoint))
             return;
@@ -758,46 +1055,59 @@ call_at_line_check(VALUE self, debug_context_t *debug_context, VALUE breakpoint,
 }
 
 static int
-set_thread_event_flag_i(st_data_t key, st_data_t val, st_data_t flag)
+set_thread_event_flag_i(st_data_t key, st_data_t val, st_data_t disabled)
 {
     VALUE thval = (VALUE)key;
+    VALUE context;
+    debug_context_t *debug_context;
     rb_thread_t *th;
+
+    if (debugging_filtered)
+    {
+        thread_context_lookup(thval, &context, &debug_context, 0);
+        if (debug_context ? CTX_FL_TEST(debug_context, CTX_FL_DISABLED)
+                          : !RTEST(debugging_default))
+        {
+            (*(int *)disabled)++;
+            return(ST_CONTINUE);
+        }
+    }
     GetThreadPtr(thval, th);
     th->event_flags |= RUBY_EVENT_VM;
 
     return(ST_CONTINUE);
 }
 
-static int
-find_prev_line_start(rb_control_frame_t *cfp)
+/*
+ * Makes sure all threads have the event flag set so we'll get their
+ * events. Once some thread has debugging off, telling them apart takes
+ * a context lookup per thread, so that is only done again when
+ * debugging is turned on or off or the number of threads changes, and
+ * stops being needed when no thread is left out.
+ */
+static void
+set_thread_event_flags(rb_thread_t *th)
 {
-#if defined HAVE_TYPE_STRUCT_ISEQ_LINE_INFO_ENTRY
-    const rb_iseq_t *iseq = cfp->iseq;
-    return rb_iseq_line_no(iseq, cfp->pc - iseq->iseq_encoded - 1);
-#else
-    int i, pos, line_no;
-    pos = cfp->pc - cfp->iseq->iseq_encoded;
-    for (i = 0; i < cfp->iseq->insn_info_size; i++)
-    {
-        if (cfp->iseq->insn_info_table[i].position != pos)
-            continue;
+    static int seen_changes = -1;
+    static long seen_threads = -1;
+    st_table *living = th->vm->living_threads;
+    int disabled = 0;
 
-        if (i == 0) return(0); // TODO
-
-        pos = -1;
-        line_no = cfp->iseq->insn_info_table[--i].line_no;
-        do {
-            if (cfp->iseq->insn_info_table[i].line_no == line_no)
-                pos = cfp->iseq->insn_info_table[i].position;
-            else
-                break;
-            i--;
-        } while (i >= 0);
+    if (debugging_filtered && seen_changes == debugging_changes &&
+        seen_threads == (long)living->num_entries)
+        return;
+    st_foreach(living, set_thread_event_flag_i, (st_data_t)&disabled);
+    seen_changes = debugging_changes;
+    seen_threads = (long)living->num_entries;
+    if (disabled == 0 && RTEST(debugging_default))
+        debugging_filtered = 0;
+}
 
-        return(pos);
-    }
-    return(-1);
-#endif
+static int
+find_prev_line_start(rb_control_frame_t *cfp)
+{
+    return iseq_index_prev_line_start(iseq_index_get(cfp->iseq),
+        cfp->pc - cfp->iseq->iseq_encoded);
 }
 
 static rb_control_frame_t *
@@ -818,8 +1128,8 @@ FUNC_FASTCALL(do_catch)(rb_thread_t *th, rb_control_frame_t *cfp)
     debug_context->jump_cfp = NULL;
 
     /* restore the proper catch table */
-    cfp->iseq->catch_table_size = debug_context->catch_table.old_catch_table_size;
-    cfp->iseq->catch_table = debug_context->catch_table.old_catch_table;
+    cfp->iseq->catch_table_size = debug_context->catcher->catch_table.old_catch_table_size;
+    cfp->iseq->catch_table = debug_context->catcher->catch_table.old_catch_table;
     CTX_FL_SET(debug_context, CTX_FL_CATCHING);
     th->cfp->sp--;
 
@@ -839,10 +1149,10 @@ catch_exception(debug_context_t *debug_context, VALUE mod_name)
         return(0);
 
     /* save the current catch table */
-    debug_context->catch_table.old_catch_table_size = cfp->iseq->catch_table_size;
-    debug_context->catch_table.old_catch_table = cfp->iseq->catch_table;
-    debug_context->catch_table.mod_name = mod_name;
-    debug_context->catch_table.errinfo = rb_errinfo();
+    debug_context->catcher->catch_table.old_catch_table_size = cfp->iseq->catch_table_size;
+    debug_context->catcher->catch_table.old_catch_table = cfp->iseq->catch_table;
+    debug_context->catcher->catch_table.mod_name = mod_name;
+    debug_context->catcher->catch_table.errinfo = rb_errinfo();
 
     /* create a new catch table to catch this exception, and put it in the current iseq */
     cfp->iseq->catch_table_size = 1;
@@ -858,48 +1168,59 @@ catch_exception(debug_context_t *debug_context, VALUE mod_name)
     return(1);
 }
 
-static void
-set_cfp(debug_context_t *debug_context)
+/*
+ * Walks the frames from +cfp+ out to +end_cfp+ and stores in +frames+
+ * (when not NULL) up to +max+ of those the debugger shows, innermost
+ * first. Returns how many were found.
+ */
+int
+walk_frames(rb_control_frame_t *cfp, rb_control_frame_t *end_cfp,
+    rb_control_frame_t **frames, int max)
 {
-    int cfp_count = 0;
-    int has_changed = 0;
-    rb_control_frame_t *cfp = debug_context->cur_cfp;
-    while (cfp <= debug_context->start_cfp)
+    int count = 0;
+
+    while (cfp <= end_cfp && count < max)
     {
-        if (cfp->iseq != NULL)
-        {
-            if (cfp->pc != NULL)
-            {
-                if ((cfp_count < debug_context->cfp_count) && (debug_context->cfp[cfp_count] != cfp))
-                    has_changed = 1;
-                cfp_count++;
-            }
-        }
-        else if (RUBYVM_CFUNC_FRAME_P(cfp))
+        if (cfp->iseq != NULL && cfp->pc != NULL)
         {
-            if ((cfp_count < debug_context->cfp_count) && (debug_context->cfp[cfp_count] != cfp))
-                has_changed = 1;
-            cfp_count++;
+            if (frames != NULL)
+                frames[count] = cfp;
+            count++;
         }
         cfp = RUBY_VM_PREVIOUS_CONTROL_FRAME(cfp);
     }
+    return count;
+}
 
-    //if (cfp_count == debug_context->cfp_count && !has_changed)
-      //  return;
+static void
+set_cfp(debug_context_t *debug_context)
+{
+    int cfp_count;
 
+    cfp_count = walk_frames(debug_context->cur_cfp, debug_context->start_cfp, NULL, INT_MAX);
     ZFREE(debug_context->cfp);
-    debug_context->cfp = (rb_control_frame_t**)malloc(sizeof(rb_control_frame_t) * cfp_count);
-    debug_context->cfp_count = 0;
+    debug_context->cfp = (rb_control_frame_t**)malloc(sizeof(rb_control_frame_t*) * (cfp_count + 1));
+    debug_context->cfp_count = walk_frames(debug_context->cur_cfp, debug_context->start_cfp,
+        debug_context->cfp, cfp_count);
+}
 
-    cfp = debug_context->cur_cfp;
-    while (cfp <= debug_context->start_cfp)
-    {
-        if (cfp->iseq != NULL)
-            if (cfp->pc != NULL) debug_context->cfp[debug_context->cfp_count++] = cfp;
-        else if (RUBYVM_CFUNC_FRAME_P(cfp))
-            debug_context->cfp[debug_context->cfp_count++] = cfp;
-        cfp = RUBY_VM_PREVIOUS_CONTROL_FRAME(cfp);
-    }
+/*
+ * The frame list is only built when something looks at it: the hook
+ * just records where it would have been built from, so events that
+ * don't stop cost the same however deep the stack is.
+ */
+static void
+ensure_frames(debug_context_t *debug_context)
+{
+    rb_control_frame_t *cur_cfp;
+
+    if (!CTX_FL_TEST(debug_context, CTX_FL_FRAMES_STALE))
+        return;
+    CTX_FL_UNSET(debug_context, CTX_FL_FRAMES_STALE);
+    cur_cfp = debug_context->cur_cfp;
+    debug_context->cur_cfp = debug_context->frames_cfp;
+    set_cfp(debug_context);
+    debug_context->cur_cfp = cur_cfp;
 }
 
 static void
@@ -923,8 +1244,8 @@ save_frames(debug_context_t *debug_context)
         bind->env = rb_vm_make_env_object(th, debug_context->cfp[size]);
     }
 
-    debug_context->catch_table.mod_name = rb_obj_class(rb_errinfo());
-    debug_context->catch_table.errinfo = rb_errinfo();
+    debug_context->catcher->catch_table.mod_name = rb_obj_class(rb_errinfo());
+    debug_context->catcher->catch_table.errinfo = rb_errinfo();
 
     debug_context->catch_cfp = GET_THREAD()->cfp;
     ZFREE(debug_context->saved_frames);
@@ -932,6 +1253,7 @@ save_frames(debug_context_t *debug_context)
     size = sizeof(rb_control_frame_t) *
         ((debug_context->cfp[debug_context->cfp_count-1] - debug_context->cfp[0]) + 1);
     debug_context->saved_frames = (rb_control_frame_t*)malloc(size);
+    debug_context->saved_frame_count = size / sizeof(rb_control_frame_t);
     memcpy(debug_context->saved_frames, debug_context->cfp[0], size);
 
     ZFREE(debug_context->saved_cfp);
@@ -977,16 +1299,13 @@ try_thread_lock(rb_thread_t *th, debug_context_t *debug_context)
 static int
 handle_raise_event(rb_thread_t *th, debug_context_t *debug_context)
 {
-    VALUE ancestors;
-    VALUE aclass;
-    int i;
-
     ZFREE(debug_context->saved_frames);
     if (CTX_FL_TEST(debug_context, CTX_FL_RETHROW))
     {
         CTX_FL_UNSET(debug_context, CTX_FL_RETHROW);
         return(0);
     }
+    ensure_frames(debug_context);
     if (debug_context->cfp_count == 0 || !try_thread_lock(th, debug_context))
         return(0);
 
@@ -1002,29 +1321,16 @@ handle_raise_event(rb_thread_t *th, debug_context_t *debug_context)
 
     debug_context->last_exception = Qnil;
 
-    if (rdebug_catchpoints == Qnil ||
+    if (rdebug_catchpoint_count == 0 ||
         (debug_context->cfp_count == 0) ||
-        CTX_FL_TEST(debug_context, CTX_FL_CATCHING) ||
-#ifdef _ST_NEW_
-        st_get_num_entries(RHASH_TBL(rdebug_catchpoints)) == 0
-#else
-        (RHASH_TBL(rdebug_catchpoints)->num_entries) == 0
-#endif
-	)
+        CTX_FL_TEST(debug_context, CTX_FL_CATCHING))
     {
         if (catchall == Qfalse) return(1);
     }
-
-    ancestors = rb_mod_ancestors(rb_obj_class(rb_errinfo()));
-    for(i = 0; i < RARRAY_LEN(ancestors); i++)
+    else
     {
-        VALUE mod_name;
-        VALUE hit_count;
-
-        aclass    = rb_ary_entry(ancestors, i);
-        mod_name  = rb_mod_name(aclass);
-        hit_count = rb_hash_aref(rdebug_catchpoints, mod_name);
-        if (hit_count != Qnil)
+        VALUE mod_name = find_catchpoint(rb_obj_class(rb_errinfo()));
+        if (mod_name != Qnil)
         {
             if (!catch_exception(debug_context, mod_name))
                 debug_runtime_error(debug_context, "Could not catch exception");
@@ -1038,7 +1344,7 @@ handle_raise_event(rb_thread_t *th, debug_context_t *debug_context)
 }
 
 static void
-debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE klass)
+event_hook_0(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE klass)
 {
     VALUE context;
     VALUE breakpoint = Qnil;
@@ -1048,14 +1354,21 @@ debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE kl
     struct rb_iseq_struct *iseq;
     const char *file;
     int line = 0;
-
-    if (hook_off == Qtrue)
-        return;
+    int skipped;
 
     th   = GET_THREAD();
     iseq = th->cfp->iseq;
     hook_count++;
     thread_context_lookup(th->self, &context, &debug_context, 1);
+    if(thread_event_count > 0)
+        thread_events_deliver();
+
+    /* a thread with debugging off stops getting events */
+    if (CTX_FL_TEST(debug_context, CTX_FL_DISABLED))
+    {
+        th->event_flags &= ~RUBY_EVENT_VM;
+        return;
+    }
 
     /* return if thread is marked as 'ignored'.
        debugger's threads are marked this way
@@ -1127,12 +1440,22 @@ debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE kl
 
     if (mid == ID_ALLOCATOR) return;
 
+    if (flight_size > 0 && (event == RUBY_EVENT_LINE || event == RUBY_EVENT_CALL))
+        flight_record(debug_context, th, event);
+
+    skipped = rdebug_skip_path_count > 0 && iseq_skipped(iseq);
+
+    if (event == RUBY_EVENT_LINE && rdebug_nonstop_count > 0 && !skipped)
+        check_nonstop_breakpoints(debug_context, th->cfp, RSTRING_PTR(iseq->filename),
+            rb_sourceline());
+
     if (!try_thread_lock(th, debug_context))
         return;
 
     if (iseq->type != ISEQ_TYPE_RESCUE && iseq->type != ISEQ_TYPE_ENSURE)
     {
-        if (debug_context->start_cfp == NULL || th->cfp > debug_context->start_cfp)
+        if (debug_context->start_cfp == NULL || th->cfp > debug_context->start_cfp ||
+            debug_context->catch_generation != catch_generation)
             create_exception_catchall(debug_context);
     }
 
@@ -1149,14 +1472,13 @@ debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE kl
         ZFREE(debug_context->old_iseq_catch);
     }
 
-    /* make sure all threads have event flag set so we'll get its events */
-    st_foreach(th->vm->living_threads, set_thread_event_flag_i, 0);
+    set_thread_event_flags(th);
 
     if (debug_context->thread_pause)
     {
         debug_context->thread_pause = 0;
         debug_context->stop_next = 1;
-        debug_context->dest_frame = -1;
+        debug_context->dest_cfp = NULL;
         moved = 1;
     }
 
@@ -1166,7 +1488,10 @@ debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE kl
 
     debug_context->cur_cfp = th->cfp;
     if (iseq->type != ISEQ_TYPE_RESCUE && iseq->type != ISEQ_TYPE_ENSURE)
-        set_cfp(debug_context);
+    {
+        debug_context->frames_cfp = th->cfp;
+        CTX_FL_SET(debug_context, CTX_FL_FRAMES_STALE);
+    }
 
     /* There can be many event calls per line, but we only want
      *one* breakpoint per line. */
@@ -1188,14 +1513,10 @@ debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE kl
     {
         if (CTX_FL_TEST(debug_context, CTX_FL_CATCHING))
         {
-            int hit_count;
-
             /* send catchpoint notification */
-            hit_count = INT2FIX(FIX2INT(rb_hash_aref(rdebug_catchpoints,
-                debug_context->catch_table.mod_name)+1));
-            rb_hash_aset(rdebug_catchpoints, debug_context->catch_table.mod_name, hit_count);
+            catchpoint_hit(debug_context->catcher->catch_table.mod_name);
             debug_context->stop_reason = CTX_STOP_CATCHPOINT;
-            rb_funcall(context, idAtCatchpoint, 1, debug_context->catch_table.errinfo);
+            rb_funcall(context, idAtCatchpoint, 1, debug_context->catcher->catch_table.errinfo);
             call_at_line(context, debug_context, rb_str_new2(file), INT2FIX(line));
 
             /* now allow the next exception to be caught */
@@ -1203,11 +1524,32 @@ debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE kl
             break;
         }
 
-        if(RTEST(tracing) || CTX_FL_TEST(debug_context, CTX_FL_TRACING))
-            rb_funcall(context, idAtTracing, 2, rb_str_new2(file), INT2FIX(line));
+        if((RTEST(tracing) || CTX_FL_TEST(debug_context, CTX_FL_TRACING)) &&
+           (!trace_filter_on || trace_filter_check(debug_context, th, th->cfp)))
+        {
+            double start = governor_on ? governor_clock() : 0;
+
+            if(trace_sink_on)
+            {
+                /* as in Context#at_tracing, start at the program's first line */
+                if(!CTX_FL_TEST(debug_context, CTX_FL_TRACE_STARTED) && iseq_in_program(iseq))
+                    CTX_FL_SET(debug_context, CTX_FL_TRACE_STARTED);
+                if(CTX_FL_TEST(debug_context, CTX_FL_TRACE_STARTED))
+                    trace_sink_line(debug_context->thnum, iseq->filename, line);
+            }
+            else
+                rb_funcall(context, idAtTracing, 2, rb_str_new2(file), INT2FIX(line));
+            if(governor_on)
+                governor_charge_tracing(start);
+        }
+
+        /* code under a skip path doesn't count as a step */
+        if(skipped)
+            break;
 
-        if(debug_context->dest_frame == -1 ||
-            debug_context->cfp_count == debug_context->dest_frame)
+        /* the stack grows down: a frame below dest_cfp is deeper */
+        if(debug_context->dest_cfp == NULL ||
+            th->cfp == debug_context->dest_cfp)
         {
             if(moved || !CTX_FL_TEST(debug_context, CTX_FL_FORCE_MOVE))
                 debug_context->stop_next--;
@@ -1220,7 +1562,7 @@ debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE kl
                 CTX_FL_UNSET(debug_context, CTX_FL_STEPPED);
             }
         }
-        else if(debug_context->cfp_count < debug_context->dest_frame)
+        else if(th->cfp > debug_context->dest_cfp)
         {
             debug_context->stop_next = 0;
         }
@@ -1237,7 +1579,7 @@ debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE kl
         breakpoint = check_breakpoints_by_method(debug_context, klass, mid, self);
         if(breakpoint != Qnil)
         {
-            if(!check_breakpoint_expression(breakpoint, rb_binding_new()))
+            if(!check_breakpoint_expression(breakpoint, th->cfp))
                 break;
             if(!check_breakpoint_hit_condition(breakpoint))
                 break;
@@ -1251,6 +1593,8 @@ debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE kl
             call_at_line(context, debug_context, rb_str_new2(file), INT2FIX(line));
             break;
         }
+        if(skipped)
+            break;
         breakpoint = check_breakpoints_by_pos(debug_context, file, line);
         if (breakpoint != Qnil)
             call_at_line_check(self, debug_context, breakpoint, context, file, line);
@@ -1265,10 +1609,10 @@ debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE kl
     case RUBY_EVENT_RETURN:
     case RUBY_EVENT_END:
     {
-        if(debug_context->cfp_count == debug_context->stop_frame)
+        if(th->cfp == debug_context->stop_cfp)
         {
             debug_context->stop_next = 1;
-            debug_context->stop_frame = 0;
+            debug_context->stop_cfp = NULL;
             /* NOTE: can't use call_at_line function here to trigger a debugger event.
                this can lead to segfault. We should only unroll the stack on this event.
              */
@@ -1301,18 +1645,101 @@ cleanup:
     }
 }
 
+static void
+debug_event_hook(rb_event_flag_t event, VALUE data, VALUE self, ID mid, VALUE klass)
+{
+    VALUE context;
+    debug_context_t *debug_context;
+    double start, paused = 0;
+
+    if (timeline_on && (event & TIMELINE_EVENTS))
+    {
+        thread_context_lookup(rb_thread_current(), &context, &debug_context, 1);
+        if (!CTX_FL_TEST(debug_context, CTX_FL_IGNORE | CTX_FL_DISABLED))
+            timeline_record(debug_context, event, mid, klass);
+    }
+    if (event == RUBY_EVENT_RAISE && exception_profiling)
+        profile_exception();
+    if (hook_off == Qtrue)
+        return;
+    if (!governor_on)
+    {
+        event_hook_0(event, data, self, mid, klass);
+        return;
+    }
+
+    start = governor_clock();
+    event_hook_0(event, data, self, mid, klass);
+    thread_context_lookup(rb_thread_current(), &context, &debug_context, 0);
+    if (debug_context)
+    {
+        paused = debug_context->governor_paused;
+        debug_context->governor_paused = 0;
+    }
+    governor_charge(start, paused);
+}
+
+/*
+ * Installs the event hook if it isn't. Until Debugger.start_ is called
+ * it only serves the exception profiler and the timeline.
+ */
+void
+rdebug_install_hook()
+{
+    if (hook_installed)
+        return;
+    rb_add_event_hook(debug_event_hook, RUBY_EVENT_ALL, Qnil);
+    hook_installed = 1;
+}
+
+/*
+ * Removes the event hook unless the debugger, the exception profiler
+ * or the timeline still needs it.
+ */
+void
+rdebug_release_hook()
+{
+    if (hook_installed && hook_off == Qtrue && !exception_profiling && !timeline_on)
+    {
+        rb_remove_event_hook(debug_event_hook);
+        hook_installed = 0;
+    }
+}
+
+/*
+ *   call-seq:
+ *      Debugger.remove_hook -> nil
+ *
+ *   Removes the event hook, so the program runs as it would without the
+ *   debugger, until Debugger.start is called. Used by
+ *   Debugger.arm_on_signal.
+ */
+static VALUE
+debug_remove_hook(VALUE self)
+{
+    hook_off = Qtrue;
+    restore_catch_tables();
+    rdebug_release_hook();
+    return Qnil;
+}
+
 /*
  *   call-seq:
  *      Debugger.start_ -> bool
- *      Debugger.start_ { ... } -> bool
+ *      Debugger.start_ { ... } -> obj
  *
  *   Deprecated.
  *
+ *   With a block, the debugger runs only while the block does and the
+ *   block's value is returned.
  */
 static VALUE
 debug_start(VALUE self)
 {
+    rdebug_install_hook();
     hook_off = Qfalse;
+    if(rb_block_given_p())
+        return rb_ensure(rb_yield, self, debug_stop, self);
     return(Qtrue);
 }
 
@@ -1326,6 +1753,9 @@ static VALUE
 debug_stop(VALUE self)
 {
     hook_off = Qtrue;
+    restore_catch_tables();
+    iseq_index_clear();
+    rdebug_release_hook();
     return Qtrue;
 }
 
@@ -1382,6 +1812,24 @@ debug_current_context(VALUE self)
     return context;
 }
 
+/*
+ *   call-seq:
+ *      Debugger.on_thread_event { |event, thnum| ... } -> proc
+ *      Debugger.on_thread_event -> nil
+ *
+ *   Calls the block with <tt>:start</tt> when a thread gets its context
+ *   and with <tt>:exit</tt> when the context of a dead thread is
+ *   dropped, both from the hook of the next thread to run. Debugger
+ *   threads are left out. Without a block, the listener is removed.
+ */
+static VALUE
+debug_on_thread_event(VALUE self)
+{
+    thread_listener = rb_block_given_p() ? rb_block_proc() : Qnil;
+    thread_event_count = 0;
+    return thread_listener;
+}
+
 /*
  *   call-seq:
  *      Debugger.thread_context(thread) -> context
@@ -1397,6 +1845,14 @@ debug_thread_context(VALUE self, VALUE thread)
     return context;
 }
 
+static int
+contexts_i(st_data_t key, st_data_t value, st_data_t list)
+{
+    if(value)
+        rb_ary_push((VALUE)list, (VALUE)value);
+    return ST_CONTINUE;
+}
+
 /*
  *   call-seq:
  *      Debugger.contexts -> array
@@ -1406,31 +1862,38 @@ debug_thread_context(VALUE self, VALUE thread)
 static VALUE
 debug_contexts(VALUE self)
 {
-    volatile VALUE list;
-    volatile VALUE new_list;
-    VALUE thread, context;
-    threads_table_t *threads_table;
+    threads_table_t *threads_table = threads_table_sync();
+    VALUE list = rb_ary_new2(threads_table->tbl->num_entries);
+
+    st_foreach(threads_table->tbl, contexts_i, list);
+    return list;
+}
+
+static void context_suspend_0(debug_context_t *debug_context);
+static void context_resume_0(debug_context_t *debug_context);
+
+static int
+suspend_i(st_data_t key, st_data_t value, st_data_t current)
+{
     debug_context_t *debug_context;
-    int i;
 
-    new_list = rb_ary_new();
-    list = rb_funcall(rb_cThread, idList, 0);
-    for(i = 0; i < RARRAY_LEN(list); i++)
-    {
-        thread = rb_ary_entry(list, i);
-        thread_context_lookup(thread, &context, NULL, 1);
-        rb_ary_push(new_list, context);
-    }
-    threads_table_clear(rdebug_threads_tbl);
-    Data_Get_Struct(rdebug_threads_tbl, threads_table_t, threads_table);
-    for(i = 0; i < RARRAY_LEN(new_list); i++)
-    {
-        context = rb_ary_entry(new_list, i);
-        Data_Get_Struct(context, debug_context_t, debug_context);
-        st_insert(threads_table->tbl, debug_context->thread_id, context);
-    }
+    if(!value || value == current)
+        return ST_CONTINUE;
+    Data_Get_Struct((VALUE)value, debug_context_t, debug_context);
+    context_suspend_0(debug_context);
+    return ST_CONTINUE;
+}
 
-    return new_list;
+static int
+resume_i(st_data_t key, st_data_t value, st_data_t current)
+{
+    debug_context_t *debug_context;
+
+    if(!value || value == current)
+        return ST_CONTINUE;
+    Data_Get_Struct((VALUE)value, debug_context_t, debug_context);
+    context_resume_0(debug_context);
+    return ST_CONTINUE;
 }
 
 /*
@@ -1442,23 +1905,11 @@ debug_contexts(VALUE self)
 static VALUE
 debug_suspend(VALUE self)
 {
-    VALUE current, context;
-    VALUE context_list;
-    debug_context_t *debug_context;
-    int i;
+    threads_table_t *threads_table = threads_table_sync();
+    VALUE current;
 
-    context_list = debug_contexts(self);
     thread_context_lookup(rb_thread_current(), &current, NULL, 1);
-
-    for(i = 0; i < RARRAY_LEN(context_list); i++)
-    {
-        context = rb_ary_entry(context_list, i);
-        if(current == context)
-            continue;
-        Data_Get_Struct(context, debug_context_t, debug_context);
-        context_suspend_0(debug_context);
-    }
-
+    st_foreach(threads_table->tbl, suspend_i, current);
     return self;
 }
 
@@ -1471,22 +1922,12 @@ debug_suspend(VALUE self)
 static VALUE
 debug_resume(VALUE self)
 {
-    VALUE current, context;
-    VALUE context_list;
-    debug_context_t *debug_context;
-    int i;
-
-    context_list = debug_contexts(self);
+    threads_table_t *threads_table;
+    VALUE current;
 
+    Data_Get_Struct(rdebug_threads_tbl, threads_table_t, threads_table);
     thread_context_lookup(rb_thread_current(), &current, NULL, 1);
-    for(i = 0; i < RARRAY_LEN(context_list); i++)
-    {
-        context = rb_ary_entry(context_list, i);
-        if(current == context)
-            continue;
-        Data_Get_Struct(context, debug_context_t, debug_context);
-        context_resume_0(debug_context);
-    }
+    st_foreach(threads_table->tbl, resume_i, current);
 
     rb_thread_schedule();
 
@@ -1515,6 +1956,86 @@ static VALUE
 debug_set_tracing(VALUE self, VALUE value)
 {
     tracing = RTEST(value) ? Qtrue : Qfalse;
+    rdebug_reset_trace_base();
+    return value;
+}
+
+static int
+stop_tracing_i(st_data_t key, st_data_t value, st_data_t dummy)
+{
+    debug_context_t *debug_context;
+
+    if (!value)
+        return(ST_CONTINUE);
+    Data_Get_Struct((VALUE)value, debug_context_t, debug_context);
+    CTX_FL_UNSET(debug_context, CTX_FL_TRACING);
+    return(ST_CONTINUE);
+}
+
+static int
+reset_trace_base_i(st_data_t key, st_data_t value, st_data_t dummy)
+{
+    debug_context_t *debug_context;
+
+    if (!value)
+        return(ST_CONTINUE);
+    Data_Get_Struct((VALUE)value, debug_context_t, debug_context);
+    debug_context->trace_base = 0;
+    return(ST_CONTINUE);
+}
+
+/*
+ * Makes each thread take the depth of the next line it traces as where
+ * tracing started, for the trace filters' depth limit.
+ */
+void
+rdebug_reset_trace_base()
+{
+    threads_table_t *threads_table;
+
+    Data_Get_Struct(rdebug_threads_tbl, threads_table_t, threads_table);
+    st_foreach(threads_table->tbl, reset_trace_base_i, 0);
+}
+
+/* Turns off tracing, for every thread too. */
+void
+rdebug_stop_tracing()
+{
+    threads_table_t *threads_table;
+
+    tracing = Qfalse;
+    Data_Get_Struct(rdebug_threads_tbl, threads_table_t, threads_table);
+    st_foreach(threads_table->tbl, stop_tracing_i, 0);
+}
+
+/*
+ *   call-seq:
+ *      Debugger.debugging_default -> bool
+ *
+ *   Returns whether threads the debugger hasn't seen yet are debugged.
+ */
+static VALUE
+debug_debugging_default(VALUE self)
+{
+    return debugging_default;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.debugging_default = bool
+ *
+ *   Sets whether threads the debugger hasn't seen yet are debugged. Set
+ *   it to false and turn on Context#debugging for the threads of
+ *   interest to leave the others running at full speed. Threads
+ *   already known keep their setting.
+ */
+static VALUE
+debug_set_debugging_default(VALUE self, VALUE value)
+{
+    debugging_default = RTEST(value) ? Qtrue : Qfalse;
+    if (!RTEST(value))
+        debugging_filtered = 1;
+    debugging_changes++;
     return value;
 }
 
@@ -1545,6 +2066,8 @@ static VALUE
 debug_set_catchall(VALUE self, VALUE value)
 {
     catchall = RTEST(value) ? Qtrue : Qfalse;
+    if (catchall == Qfalse)
+        restore_catch_tables();
     return value;
 }
 
@@ -1716,6 +2239,7 @@ context_step_over(int argc, VALUE *argv, VALUE self)
     debug_context_t *debug_context;
 
     Data_Get_Struct(self, debug_context_t, debug_context);
+    ensure_frames(debug_context);
     if(debug_context->cfp_count == 0)
         rb_raise(rb_eRuntimeError, "No frames collected.");
 
@@ -1724,13 +2248,13 @@ context_step_over(int argc, VALUE *argv, VALUE self)
     CTX_FL_UNSET(debug_context, CTX_FL_STEPPED);
     if(frame == Qnil)
     {
-        debug_context->dest_frame = debug_context->cfp_count;
+        debug_context->dest_cfp = debug_context->cfp[0];
     }
     else
     {
-        if(FIX2INT(frame) < 0 && FIX2INT(frame) >= debug_context->cfp_count)
+        if(FIX2INT(frame) < 0 || FIX2INT(frame) >= debug_context->cfp_count)
             rb_raise(rb_eRuntimeError, "Destination frame is out of range.");
-        debug_context->dest_frame = debug_context->cfp_count - FIX2INT(frame);
+        debug_context->dest_cfp = debug_context->cfp[FIX2INT(frame)];
     }
     if(RTEST(force))
         CTX_FL_SET(debug_context, CTX_FL_FORCE_MOVE);
@@ -1745,6 +2269,7 @@ context_step_over(int argc, VALUE *argv, VALUE self)
  *      context.stop_frame(frame)
  *
  *   Stops when a frame with number +frame+ is activated. Implements +finish+ and +next+ commands.
+ *   A negative +frame+ cancels a previous request.
  */
 static VALUE
 context_stop_frame(VALUE self, VALUE frame)
@@ -1752,9 +2277,15 @@ context_stop_frame(VALUE self, VALUE frame)
     debug_context_t *debug_context;
 
     Data_Get_Struct(self, debug_context_t, debug_context);
-    if(FIX2INT(frame) < 0 && FIX2INT(frame) >= debug_context->cfp_count)
+    ensure_frames(debug_context);
+    if(FIX2INT(frame) < 0)
+    {
+        debug_context->stop_cfp = NULL;
+        return frame;
+    }
+    if(FIX2INT(frame) >= debug_context->cfp_count)
         rb_raise(rb_eRuntimeError, "Stop frame is out of range.");
-    debug_context->stop_frame = debug_context->cfp_count - FIX2INT(frame);
+    debug_context->stop_cfp = debug_context->cfp[FIX2INT(frame)];
 
     return frame;
 }
@@ -1764,6 +2295,7 @@ check_frame_number(debug_context_t *debug_context, VALUE frame)
 {
     int frame_n;
 
+    ensure_frames(debug_context);
     frame_n = FIX2INT(frame);
     if(frame_n < 0 || frame_n >= debug_context->cfp_count)
     rb_raise(rb_eArgError, "Invalid frame number %d, stack (0...%d)",
@@ -1813,6 +2345,30 @@ context_frame_binding(int argc, VALUE *argv, VALUE self)
     return bindval;
 }
 
+/*
+ *   call-seq:
+ *      context.frame_env_id(frame_position=0) -> int
+ *
+ *   Returns an id for the frame's local variables that stays the same
+ *   while the frame runs, so something compiled against its binding
+ *   can be reused.
+ */
+static VALUE
+context_frame_env_id(int argc, VALUE *argv, VALUE self)
+{
+    VALUE frame;
+    debug_context_t *debug_context;
+    rb_control_frame_t *cfp;
+    rb_thread_t *th;
+
+    frame = optional_frame_position(argc, argv);
+    Data_Get_Struct(self, debug_context_t, debug_context);
+    GetThreadPtr(context_thread_0(debug_context), th);
+    cfp = GET_CFP;
+
+    return rb_obj_id(rb_vm_make_env_object(th, cfp));
+}
+
 /*
  *   call-seq:
  *      context.frame_method(frame_position=0) -> sym
@@ -1883,26 +2439,14 @@ context_frame_file(int argc, VALUE *argv, VALUE self)
 }
 
 /*
- *   call-seq:
- *      context.frame_locals(frame) -> hash
- *
- *   Returns frame's local variables.
+ * Returns a hash of the local variables of +cfp+, by name.
  */
-static VALUE
-context_frame_locals(int argc, VALUE *argv, VALUE self)
+VALUE
+frame_locals(rb_control_frame_t *cfp)
 {
-    VALUE frame;
-    debug_context_t *debug_context;
     int i;
-    rb_control_frame_t *cfp;
-    rb_iseq_t *iseq;
-    VALUE hash;
-
-    frame = optional_frame_position(argc, argv);
-    Data_Get_Struct(self, debug_context_t, debug_context);
-    cfp = GET_CFP;
-    iseq = cfp->iseq;
-    hash = rb_hash_new();
+    rb_iseq_t *iseq = cfp->iseq;
+    VALUE hash = rb_hash_new();
 
     if (iseq != NULL && iseq->local_table != NULL)
     {
@@ -1918,6 +2462,25 @@ context_frame_locals(int argc, VALUE *argv, VALUE self)
     return(hash);
 }
 
+/*
+ *   call-seq:
+ *      context.frame_locals(frame) -> hash
+ *
+ *   Returns frame's local variables.
+ */
+static VALUE
+context_frame_locals(int argc, VALUE *argv, VALUE self)
+{
+    VALUE frame;
+    debug_context_t *debug_context;
+    rb_control_frame_t *cfp;
+
+    frame = optional_frame_position(argc, argv);
+    Data_Get_Struct(self, debug_context_t, debug_context);
+    cfp = GET_CFP;
+    return frame_locals(cfp);
+}
+
 /*
  *   call-seq:
  *      context.frame_args(frame_position=0) -> list
@@ -2008,6 +2571,7 @@ context_stack_size(VALUE self)
 {
     debug_context_t *debug_context;
     Data_Get_Struct(self, debug_context_t, debug_context);
+    ensure_frames(debug_context);
     return(INT2FIX(debug_context->cfp_count));
 }
 
@@ -2210,6 +2774,7 @@ context_set_tracing(VALUE self, VALUE value)
         CTX_FL_SET(debug_context, CTX_FL_TRACING);
     else
         CTX_FL_UNSET(debug_context, CTX_FL_TRACING);
+    debug_context->trace_base = 0;
     return value;
 }
 
@@ -2228,6 +2793,53 @@ context_ignored(VALUE self)
     return CTX_FL_TEST(debug_context, CTX_FL_IGNORE) ? Qtrue : Qfalse;
 }
 
+/*
+ *   call-seq:
+ *      context.debugging? -> bool
+ *
+ *   Returns whether the debugger looks at this thread at all.
+ */
+static VALUE
+context_debugging(VALUE self)
+{
+    debug_context_t *debug_context;
+
+    Data_Get_Struct(self, debug_context_t, debug_context);
+    return CTX_FL_TEST(debug_context, CTX_FL_DISABLED) ? Qfalse : Qtrue;
+}
+
+/*
+ *   call-seq:
+ *      context.debugging = bool
+ *
+ *   Turns debugging of this thread on or off. With debugging off the
+ *   VM doesn't call the debugger's hook for the thread, so it runs at
+ *   full speed but ignores breakpoints and can't be stepped. Hooks set
+ *   with set_trace_func aren't called for it either.
+ */
+static VALUE
+context_set_debugging(VALUE self, VALUE value)
+{
+    debug_context_t *debug_context;
+    rb_thread_t *th;
+
+    Data_Get_Struct(self, debug_context_t, debug_context);
+    GetThreadPtr(context_thread_0(debug_context), th);
+    if(RTEST(value))
+    {
+        CTX_FL_UNSET(debug_context, CTX_FL_DISABLED);
+        th->event_flags |= RUBY_EVENT_VM;
+    }
+    else
+    {
+        CTX_FL_SET(debug_context, CTX_FL_DISABLED);
+        th->event_flags &= ~RUBY_EVENT_VM;
+        debugging_filtered = 1;
+    }
+    debugging_changes++;
+    return value;
+}
+
 /*
  *   call-seq:
  *      context.dead? -> bool
@@ -2290,7 +2902,7 @@ static VALUE
 context_jump(VALUE self, VALUE line, VALUE file)
 {
     debug_context_t *debug_context;
-    int i;
+    int pos;
     rb_thread_t *th;
     rb_control_frame_t *cfp;
     rb_control_frame_t *cfp_end;
@@ -2313,11 +2925,9 @@ context_jump(VALUE self, VALUE line, VALUE file)
     {
         if ((cfp->iseq != NULL) && (rb_str_cmp(file, cfp->iseq->filename) == 0))
         {
-            for (i = 0; i < cfp->iseq->line_info_size; i++)
+            pos = iseq_index_line_pos(iseq_index_get(cfp->iseq), line);
+            if (pos >= 0)
             {
-                if (cfp->iseq->line_info_table[i].line_no != line)
-                    continue;
-
                 /* hijack the currently running code so that we can change the frame PC */
                 debug_context->saved_jump_ins[0] = cfp_start->pc[0];
                 debug_context->saved_jump_ins[1] = cfp_start->pc[1];
@@ -2325,8 +2935,7 @@ context_jump(VALUE self, VALUE line, VALUE file)
                 cfp_start->pc[1] = (VALUE)do_jump;
 
                 debug_context->jump_cfp = cfp;
-                debug_context->jump_pc =
-                    cfp->iseq->iseq_encoded + cfp->iseq->line_info_table[i].position;
+                debug_context->jump_pc = cfp->iseq->iseq_encoded + pos;
 
                 return(INT2FIX(0)); /* success */
             }
@@ -2387,8 +2996,11 @@ Init_context(void)
     rb_define_method(cContext, "tracing", context_tracing, 0);
     rb_define_method(cContext, "tracing=", context_set_tracing, 1);
     rb_define_method(cContext, "ignored?", context_ignored, 0);
+    rb_define_method(cContext, "debugging?", context_debugging, 0);
+    rb_define_method(cContext, "debugging=", context_set_debugging, 1);
     rb_define_method(cContext, "frame_args", context_frame_args, -1);
     rb_define_method(cContext, "frame_binding", context_frame_binding, -1);
+    rb_define_method(cContext, "frame_env_id", context_frame_env_id, -1);
     rb_define_method(cContext, "frame_class", context_frame_class, -1);
     rb_define_method(cContext, "frame_file", context_frame_file, -1);
     rb_define_method(cContext, "frame_id", context_frame_id, -1);
@@ -2404,6 +3016,8 @@ Init_context(void)
              context_breakpoint, 0);      /* in breakpoint.c */
     rb_define_method(cContext, "set_breakpoint",
              context_set_breakpoint, -1); /* in breakpoint.c */
+    rb_define_method(cContext, "history",
+             context_history, -1);        /* in flight_recorder.c */
     rb_define_method(cContext, "jump", context_jump, 2);
     rb_define_method(cContext, "pause", context_pause, 0);
 }
@@ -2429,14 +3043,91 @@ debug_breakpoints(VALUE self)
  *   <i>pos</i> is a line number or a method name if <i>source</i> is a class name.
  *   <i>condition</i> is a string which is evaluated to +true+ when this breakpoint
  *   is activated.
+ *
+ *   If code from <i>source</i> is loaded and <i>pos</i> is a line with no
+ *   code on it, the breakpoint is moved to the next line that has some.
+ *   ArgumentError is raised if there is no such line.
  */
 static VALUE
 debug_add_breakpoint(int argc, VALUE *argv, VALUE self)
 {
     VALUE result;
 
-    result = create_breakpoint_from_args(argc, argv, ++bkp_count);
+    result = create_breakpoint_from_args(argc, argv, bkp_count + 1);
+    snap_breakpoint_line(result);
+    bkp_count++;
+    rb_ary_push(rdebug_breakpoints, result);
+    return result;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.add_logpoint(source, line, format) -> breakpoint
+ *
+ *   Adds a breakpoint that writes a message instead of stopping. Each
+ *   time the line is reached, +format+ is written to Debugger.log_file
+ *   with every <tt>{name}</tt> in it replaced by the inspected value of
+ *   local variable +name+; <tt>{@name}</tt> gives an instance variable
+ *   and <tt>{self}</tt> the receiver. The thread never waits for the
+ *   debugger. The breakpoint's condition and hit condition apply, so
+ *   <tt>hit_condition = :mod</tt> logs one hit in every +hit_value+.
+ */
+static VALUE
+debug_add_logpoint(VALUE self, VALUE source, VALUE line, VALUE format)
+{
+    VALUE result;
+
+    result = create_logpoint(source, line, format, bkp_count + 1);
+    snap_breakpoint_line(result);
+    bkp_count++;
     rb_ary_push(rdebug_breakpoints, result);
+    rdebug_nonstop_count++;
+    return result;
+}
+
+#define SNAPSHOT_DEFAULT_DEPTH 20
+#define SNAPSHOT_DEFAULT_BYTES 16384
+
+static int
+snapshot_option(VALUE options, const char *name, int default_value)
+{
+    VALUE value;
+
+    if (NIL_P(options))
+        return default_value;
+    value = rb_hash_aref(options, ID2SYM(rb_intern(name)));
+    return NIL_P(value) ? default_value : NUM2INT(value);
+}
+
+/*
+ *   call-seq:
+ *      Debugger.add_snapshot(source, line, options = {}) -> breakpoint
+ *
+ *   Adds a breakpoint that records the state of the thread instead of
+ *   stopping: the backtrace and the inspected local variables of each
+ *   frame, read back with Debugger.snapshots. Options are
+ *   <tt>:max_depth</tt>, the number of frames kept (20),
+ *   <tt>:max_bytes</tt>, the size of a snapshot's text (16384), and
+ *   <tt>:count</tt>, the number of hits recorded (1) after which the
+ *   breakpoint disables itself. The thread never waits for the
+ *   debugger.
+ */
+static VALUE
+debug_add_snapshot(int argc, VALUE *argv, VALUE self)
+{
+    VALUE source, line, options, result;
+
+    rb_scan_args(argc, argv, "21", &source, &line, &options);
+    if (!NIL_P(options))
+        Check_Type(options, T_HASH);
+    result = create_snapshot_point(source, line, bkp_count + 1,
+        snapshot_option(options, "max_depth", SNAPSHOT_DEFAULT_DEPTH),
+        snapshot_option(options, "max_bytes", SNAPSHOT_DEFAULT_BYTES),
+        snapshot_option(options, "count", 1));
+    snap_breakpoint_line(result);
+    bkp_count++;
+    rb_ary_push(rdebug_breakpoints, result);
+    rdebug_nonstop_count++;
     return result;
 }
 
@@ -2478,8 +3169,11 @@ Init_ruby_debug(void)
     rb_define_module_function(mDebugger, "start_", debug_start, 0);
     rb_define_module_function(mDebugger, "stop", debug_stop, 0);
     rb_define_module_function(mDebugger, "started?", debug_is_started, 0);
+    rb_define_module_function(mDebugger, "remove_hook", debug_remove_hook, 0);
     rb_define_module_function(mDebugger, "breakpoints", debug_breakpoints, 0);
     rb_define_module_function(mDebugger, "add_breakpoint", debug_add_breakpoint, -1);
+    rb_define_module_function(mDebugger, "add_logpoint", debug_add_logpoint, 3);
+    rb_define_module_function(mDebugger, "add_snapshot", debug_add_snapshot, -1);
     rb_define_module_function(mDebugger, "remove_breakpoint",
                   rdebug_remove_breakpoint,
                   1);                        /* in breakpoint.c */
@@ -2491,10 +3185,13 @@ Init_ruby_debug(void)
     rb_define_module_function(mDebugger, "contexts", debug_contexts, 0);
     rb_define_module_function(mDebugger, "current_context", debug_current_context, 0);
     rb_define_module_function(mDebugger, "thread_context", debug_thread_context, 1);
+    rb_define_module_function(mDebugger, "on_thread_event", debug_on_thread_event, 0);
     rb_define_module_function(mDebugger, "suspend", debug_suspend, 0);
     rb_define_module_function(mDebugger, "resume", debug_resume, 0);
     rb_define_module_function(mDebugger, "tracing", debug_tracing, 0);
     rb_define_module_function(mDebugger, "tracing=", debug_set_tracing, 1);
+    rb_define_module_function(mDebugger, "debugging_default", debug_debugging_default, 0);
+    rb_define_module_function(mDebugger, "debugging_default=", debug_set_debugging_default, 1);
     rb_define_module_function(mDebugger, "debug_load", debug_debug_load, -1);
     rb_define_module_function(mDebugger, "skip", debug_skip, 0);
     rb_define_module_function(mDebugger, "debug_at_exit", debug_at_exit, 0);
@@ -2512,30 +3209,49 @@ Init_ruby_debug(void)
 
     Init_context();
     Init_breakpoint();
+    Init_source_cache();
+    Init_iseq_index();
+    Init_snapshot();
+    Init_governor();
+    Init_condition();
+    Init_exception_profile();
+    Init_flight_recorder();
+    Init_trace_sink();
+    Init_trace_filter();
+    Init_timeline();
 
     idAtBreakpoint = rb_intern("at_breakpoint");
     idAtCatchpoint = rb_intern("at_catchpoint");
     idAtLine       = rb_intern("at_line");
     idAtReturn     = rb_intern("at_return");
     idAtTracing    = rb_intern("at_tracing");
+    idCall         = rb_intern("call");
     idList         = rb_intern("list");
 
     rb_mObjectSpace = rb_const_get(rb_mKernel, rb_intern("ObjectSpace"));
 
+    rb_global_variable(&thread_listener);
     rb_global_variable(&last_context);
     rb_global_variable(&last_thread);
     rb_global_variable(&locker);
     rb_global_variable(&rdebug_breakpoints);
-    rb_global_variable(&rdebug_catchpoints);
     rb_global_variable(&rdebug_threads_tbl);
-
-    /* start the debugger hook */
+    catch_patches = st_init_numtable();
+    catch_patches_holder = Data_Wrap_Struct(rb_cObject, catch_patches_mark, 0, 0);
+    rb_global_variable(&catch_patches_holder);
+    catcher_name = rb_obj_freeze(rb_str_new_cstr("(exception catcher)"));
+    catcher_mark_ary = rb_ary_new();
+    rb_global_variable(&catcher_name);
+    rb_global_variable(&catcher_mark_ary);
+    rb_global_variable(&catch_iseq);
+
+    /* start the debugger hook, unless it is to wait for a signal */
     id_binding_n       = rb_intern("binding_n");
     id_frame_binding   = rb_intern("frame_binding");
-    hook_off           = Qfalse;
     locker             = Qnil;
     rdebug_breakpoints = rb_ary_new();
-    rdebug_catchpoints = rb_hash_new();
     rdebug_threads_tbl = threads_table_create();
-    rb_add_event_hook(debug_event_hook, RUBY_EVENT_ALL, Qnil);
+    catch_iseq         = compile_catch_iseq();
+    if (getenv("RDEBUG_ARM_SIGNAL") == NULL)
+        debug_start(mDebugger);
 }
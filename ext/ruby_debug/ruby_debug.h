@@ -16,6 +16,9 @@ enum ctx_stop_reason {CTX_STOP_NONE, CTX_STOP_STEP, CTX_STOP_BREAKPOINT,
 #define CTX_FL_EXCEPTION_TEST (1<<11)
 #define CTX_FL_ENSURE_SKIPPED (1<<12)
 #define CTX_FL_RETHROW        (1<<13)
+#define CTX_FL_FRAMES_STALE   (1<<14)
+#define CTX_FL_DISABLED       (1<<15)
+#define CTX_FL_TRACE_STARTED  (1<<16)
 
 #define CTX_FL_TEST(c,f)  ((c)->flags & (f))
 #define CTX_FL_SET(c,f)   do { (c)->flags |= (f); } while (0)
@@ -35,35 +38,17 @@ typedef struct {
     int catch_table_size;
 } iseq_catch_t;
 
-typedef struct {
-    VALUE thread_id;
-    int thnum;
-    int flags;
-    enum ctx_stop_reason stop_reason;
-    int stop_next;
-    int dest_frame;
-    int stop_line;
-    int stop_frame;
-    int stack_len;
-    const char * last_file;
-    int last_line;
-    VALUE breakpoint;
+/*
+ * What a thread needs to catch exceptions: the catch table entry and
+ * state of a catch in progress, and the iseq of the exception catcher
+ * that create_exception_catchall puts in the catch table of the
+ * thread's outermost frame. Allocated the first time a thread needs
+ * it. Since iseqs keep pointing at the catcher after its thread dies,
+ * it isn't freed then but kept for the next thread that needs one.
+ */
+typedef struct debug_catcher {
+    struct debug_catcher *next; /* in the list of unused catchers */
     debug_catch_t catch_table;
-    VALUE saved_jump_ins[2];
-    rb_control_frame_t *jump_cfp;
-    VALUE *jump_pc;
-    iseq_catch_t *old_iseq_catch;
-    VALUE last_exception;
-    volatile int thread_pause;
-//
-    rb_control_frame_t *start_cfp;
-    rb_control_frame_t *cur_cfp;
-    rb_control_frame_t *top_cfp;
-    rb_control_frame_t *catch_cfp;
-    rb_control_frame_t *saved_frames;
-    rb_control_frame_t **saved_cfp;
-    int saved_cfp_count;
-//
     struct RData catch_rdata;
     struct rb_iseq_struct catch_iseq;
 #if defined HAVE_TYPE_STRUCT_ISEQ_INSN_INFO_ENTRY
@@ -76,19 +61,77 @@ typedef struct {
     struct RNode catch_cref_stack;
     VALUE iseq_insn[7];
     VALUE local_table;
+} debug_catcher_t;
+
+/* The flight recorder's ring buffer of a thread, see flight_recorder.c */
+typedef struct flight_ring flight_ring_t;
+
+/* The timeline's events of a thread, see timeline.c */
+typedef struct timeline_buffer timeline_buffer_t;
+
+#ifdef __GNUC__
+#define RDEBUG_CACHE_LINE 64
+#define RDEBUG_CACHE_ALIGNED __attribute__((aligned(RDEBUG_CACHE_LINE)))
+#else
+#define RDEBUG_CACHE_ALIGNED
+#endif
+
+typedef struct {
+    /* looked at on every event: kept together in the first cache line */
+    int flags;
+    int stop_next;
+    int stop_line;
+    int last_line;
+    const char * last_file;
+    rb_control_frame_t *dest_cfp; /* frame "next" steps in, NULL for any */
+    rb_control_frame_t *stop_cfp; /* frame "finish" stops after, or NULL */
+    rb_control_frame_t *top_cfp;
+    rb_control_frame_t *start_cfp;
+    rb_control_frame_t *catch_cfp;
 //
+    rb_control_frame_t *cur_cfp;
+    rb_control_frame_t *frames_cfp; /* where the frame list is built from */
     rb_control_frame_t **cfp;
     int cfp_count;
-} debug_context_t;
+    volatile int thread_pause;
+    enum ctx_stop_reason stop_reason;
+    int thnum;
+    VALUE thread_id;
+    VALUE breakpoint;
+    VALUE last_exception;
+    double governor_paused; /* time stopped at the prompt, see governor.c */
+//
+    VALUE saved_jump_ins[2];
+    rb_control_frame_t *jump_cfp;
+    VALUE *jump_pc;
+    iseq_catch_t *old_iseq_catch;
+    rb_control_frame_t *saved_frames;
+    int saved_frame_count;        /* frames in saved_frames */
+    rb_control_frame_t **saved_cfp;
+    int saved_cfp_count;
+    debug_catcher_t *catcher;     /* NULL until needed */
+    int catch_generation;         /* see restore_catch_tables */
+    flight_ring_t *flight;        /* NULL until something is recorded */
+    int trace_base;               /* depth tracing started at, 0 if unknown */
+    timeline_buffer_t *timeline;  /* valid while timeline_generation matches */
+    int timeline_generation;
+} RDEBUG_CACHE_ALIGNED debug_context_t;
 
 /* variables in ruby_debug.c */
 extern VALUE mDebugger;
 extern VALUE rdebug_breakpoints;
-extern VALUE rdebug_catchpoints;
+extern int   rdebug_catchpoint_count;
 extern VALUE rdebug_threads_tbl;
 
 /* routines in ruby_debug.c */
 extern int  filename_cmp(VALUE source, const char *file);
+extern int  walk_frames(rb_control_frame_t *cfp, rb_control_frame_t *end_cfp,
+    rb_control_frame_t **frames, int max);
+extern VALUE frame_locals(rb_control_frame_t *cfp);
+extern void rdebug_stop_tracing();
+extern void rdebug_reset_trace_base();
+extern void rdebug_install_hook();
+extern void rdebug_release_hook();
 
 static inline int
 classname_cmp(VALUE name, VALUE klass)
@@ -104,6 +147,8 @@ classname_cmp(VALUE name, VALUE klass)
 /* Breakpoint information */
 enum bp_type {BP_POS_TYPE, BP_METHOD_TYPE};
 enum hit_condition {HIT_COND_NONE, HIT_COND_GE, HIT_COND_EQ, HIT_COND_MOD};
+/* what happens when a breakpoint is hit */
+enum bp_action {BP_ACTION_STOP, BP_ACTION_LOG, BP_ACTION_SNAPSHOT};
 
 typedef struct {
     int   id;
@@ -119,20 +164,135 @@ typedef struct {
     int hit_count;
     int hit_value;
     enum hit_condition hit_condition;
+    enum bp_action action;
+    VALUE format;     /* logpoint message template */
+    VALUE template;   /* format parsed by create_logpoint */
+    int max_depth;    /* frames kept by a snapshot */
+    int max_bytes;    /* size of a snapshot's text */
+    int remaining;    /* snapshots left to take before disarming */
+    int sample;       /* only every sample-th hit is looked at, 0 for all */
+    int sample_seen;
+    double cost;      /* CPU time spent on it, see governor.c */
+    ID cond_op;       /* native form of expr, see condition.c; 0 if none */
+    ID cond_id;
+    VALUE cond_value;
+    int *thnums;      /* threads it applies to, all if thnum_count is 0 */
+    int thnum_count;
 } debug_breakpoint_t;
 
 /* routines in breakpoint.c */
-extern int   check_breakpoint_expression(VALUE breakpoint, VALUE binding);
+extern int   check_breakpoint_expression(VALUE breakpoint, rb_control_frame_t *cfp);
 extern int   check_breakpoint_hit_condition(VALUE breakpoint);
 extern VALUE check_breakpoints_by_method(debug_context_t *debug_context,
     VALUE klass, ID mid, VALUE self);
 extern VALUE check_breakpoints_by_pos(debug_context_t *debug_context,
     const char *file, int line);
 extern VALUE create_breakpoint_from_args(int argc, VALUE *argv, int id);
+extern void  snap_breakpoint_line(VALUE breakpoint);
+extern VALUE create_logpoint(VALUE source, VALUE line, VALUE format, int id);
+extern VALUE create_snapshot_point(VALUE source, VALUE line, int id,
+    int max_depth, int max_bytes, int count);
+extern void  check_nonstop_breakpoints(debug_context_t *debug_context,
+    rb_control_frame_t *cfp, const char *file, int line);
+extern int   rdebug_nonstop_count;
+extern VALUE inspect_bounded(VALUE value, long max);
+extern int   frame_local(rb_control_frame_t *cfp, ID id, VALUE *value);
 extern VALUE context_breakpoint(VALUE self);
 extern VALUE context_set_breakpoint(int argc, VALUE *argv, VALUE self);
 extern VALUE rdebug_add_catchpoint(VALUE self, VALUE value);
 extern VALUE debug_catchpoints(VALUE self);
+extern VALUE find_catchpoint(VALUE klass);
+extern void  catchpoint_hit(VALUE name);
 extern VALUE rdebug_remove_breakpoint(VALUE self, VALUE id_value);
 
 extern void Init_breakpoint();
+
+/* Line table of an iseq, see iseq_index.c */
+typedef struct {
+    unsigned int position;
+    unsigned int start;   /* first position of this entry's line */
+    int line;
+} iseq_pos_entry_t;
+
+typedef struct {
+    VALUE iseq;           /* marked, so the address isn't reused */
+    int size;
+    unsigned int flags;
+    iseq_pos_entry_t *by_pos;
+    iseq_pos_entry_t *by_line;
+} iseq_index_t;
+
+/* routines in iseq_index.c */
+extern iseq_index_t *iseq_index_get(const rb_iseq_t *iseq);
+extern int  iseq_index_line_pos(iseq_index_t *index, int line);
+extern int  iseq_index_pos_line(iseq_index_t *index, unsigned int pos);
+extern int  iseq_index_prev_line_start(iseq_index_t *index, unsigned int pos);
+extern int  executable_lines(VALUE file, int **lines);
+extern void iseq_index_clear();
+extern int  iseq_skipped(const rb_iseq_t *iseq);
+extern int  iseq_traced(const rb_iseq_t *iseq);
+extern int  iseq_in_program(const rb_iseq_t *iseq);
+extern void iseq_index_forget_traced();
+extern int  rdebug_skip_path_count;
+extern void Init_iseq_index();
+
+/* routines in source_cache.c */
+extern void source_cache_expire();
+extern void Init_source_cache();
+
+/* routines in condition.c */
+extern void compile_condition(debug_breakpoint_t *breakpoint);
+extern int  check_native_condition(debug_breakpoint_t *breakpoint,
+    rb_control_frame_t *cfp, int *result);
+extern void Init_condition();
+
+/* routines in governor.c */
+extern int    governor_on;
+extern double wall_clock();
+extern double governor_clock();
+extern void   governor_charge(double start, double paused);
+extern void   governor_charge_breakpoint(debug_breakpoint_t *debug_breakpoint,
+    double start);
+extern void   governor_charge_tracing(double start);
+extern void   Init_governor();
+
+/* routines in snapshot.c */
+extern void take_snapshot(debug_context_t *debug_context,
+    debug_breakpoint_t *breakpoint, rb_control_frame_t *cfp,
+    const char *file, int line);
+extern void Init_snapshot();
+
+/* routines in exception_profile.c */
+extern int  exception_profiling;
+extern void profile_exception();
+extern void Init_exception_profile();
+
+/* routines in flight_recorder.c */
+extern int    flight_size;
+extern void   flight_record(debug_context_t *debug_context, rb_thread_t *th,
+    rb_event_flag_t event);
+extern void   flight_mark(flight_ring_t *ring);
+extern void   flight_free(flight_ring_t *ring);
+extern size_t flight_memsize(const flight_ring_t *ring);
+extern VALUE  context_history(int argc, VALUE *argv, VALUE self);
+extern void   Init_flight_recorder();
+
+/* routines in trace_sink.c */
+extern int  trace_sink_on;
+extern void trace_sink_line(int thnum, VALUE filename, int line);
+extern void Init_trace_sink();
+
+/* routines in trace_filter.c */
+extern int  trace_filter_on;
+extern int  trace_filter_match(const rb_iseq_t *iseq);
+extern int  trace_filter_check(debug_context_t *debug_context, rb_thread_t *th,
+    rb_control_frame_t *cfp);
+extern void Init_trace_filter();
+
+/* routines in timeline.c */
+#define TIMELINE_EVENTS (RUBY_EVENT_CALL | RUBY_EVENT_RETURN | \
+    RUBY_EVENT_C_CALL | RUBY_EVENT_C_RETURN)
+extern int  timeline_on;
+extern void timeline_record(debug_context_t *debug_context, rb_event_flag_t event,
+    ID mid, VALUE klass);
+extern void Init_timeline();
@@ -0,0 +1,237 @@
+#include <ruby.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vm_core.h>
+#include <iseq.h>
+#include "ruby_debug.h"
+
+RUBY_EXTERN int rb_vm_get_sourceline(const rb_control_frame_t *cfp); /* from vm.c */
+
+/*
+ * Snapshots taken by snapshot points. Each one is the text of the
+ * backtrace and the inspected locals of the thread that hit the point,
+ * rendered into a buffer of at most the point's max_bytes and kept
+ * outside the Ruby heap. Once the snapshots kept add up to more than
+ * SNAPSHOT_MAX_STORED bytes the oldest ones are dropped.
+ */
+
+#define SNAPSHOT_MAX_STORED (1024 * 1024)
+/* longest inspect() of a local variable in a snapshot */
+#define SNAPSHOT_MAX_VALUE 256
+
+typedef struct snapshot {
+    struct snapshot *next;
+    int id;
+    int breakpoint_id;
+    int thnum;
+    time_t time;
+    char *file;
+    int line;
+    int truncated;
+    size_t len;
+    char text[1];
+} snapshot_t;
+
+/* text of a snapshot being taken */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t max;
+    int truncated;
+} snapshot_buf_t;
+
+static snapshot_t *snapshots_head = NULL;
+static snapshot_t *snapshots_tail = NULL;
+static size_t snapshots_size = 0;
+static int snapshot_count = 0;
+
+static void
+buf_cat(snapshot_buf_t *buf, const char *str, size_t len)
+{
+    if(buf->len + len > buf->max)
+    {
+        len = buf->max - buf->len;
+        buf->truncated = 1;
+    }
+    memcpy(buf->buf + buf->len, str, len);
+    buf->len += len;
+}
+
+static void
+buf_cat_str(snapshot_buf_t *buf, VALUE str)
+{
+    buf_cat(buf, RSTRING_PTR(str), RSTRING_LEN(str));
+}
+
+static int
+buf_cat_local_i(VALUE name, VALUE value, VALUE arg)
+{
+    snapshot_buf_t *buf = (snapshot_buf_t *)arg;
+
+    if(buf->truncated)
+        return ST_STOP;
+    buf_cat(buf, "    ", 4);
+    buf_cat_str(buf, name);
+    buf_cat(buf, " = ", 3);
+    buf_cat_str(buf, inspect_bounded(value, SNAPSHOT_MAX_VALUE));
+    buf_cat(buf, "\n", 1);
+    return ST_CONTINUE;
+}
+
+static void
+buf_cat_frame(snapshot_buf_t *buf, int n, rb_control_frame_t *cfp)
+{
+    char line[32];
+    rb_iseq_t *iseq = cfp->iseq;
+
+    snprintf(line, sizeof(line), "#%d ", n);
+    buf_cat(buf, line, strlen(line));
+    if(TYPE(iseq->filename) == T_STRING)
+        buf_cat_str(buf, iseq->filename);
+    snprintf(line, sizeof(line), ":%d", rb_vm_get_sourceline(cfp));
+    buf_cat(buf, line, strlen(line));
+    if(TYPE(iseq->name) == T_STRING)
+    {
+        buf_cat(buf, " in `", 5);
+        buf_cat_str(buf, iseq->name);
+        buf_cat(buf, "'", 1);
+    }
+    buf_cat(buf, "\n", 1);
+    rb_hash_foreach(frame_locals(cfp), buf_cat_local_i, (VALUE)buf);
+}
+
+static void
+snapshot_free(snapshot_t *snapshot)
+{
+    xfree(snapshot->file);
+    xfree(snapshot);
+}
+
+static void
+snapshot_store(snapshot_t *snapshot)
+{
+    if(snapshots_tail)
+        snapshots_tail->next = snapshot;
+    else
+        snapshots_head = snapshot;
+    snapshots_tail = snapshot;
+    snapshots_size += snapshot->len;
+    while(snapshots_size > SNAPSHOT_MAX_STORED && snapshots_head != snapshot)
+    {
+        snapshot_t *oldest = snapshots_head;
+        snapshots_head = oldest->next;
+        snapshots_size -= oldest->len;
+        snapshot_free(oldest);
+    }
+}
+
+/*
+ * Records the state of the thread at +cfp+ for snapshot point
+ * +breakpoint+, which was hit at +file+:+line+. Called from the event
+ * hook without the debugger lock; the thread doesn't stop.
+ */
+void
+take_snapshot(debug_context_t *debug_context, debug_breakpoint_t *breakpoint,
+    rb_control_frame_t *cfp, const char *file, int line)
+{
+    rb_thread_t *th = GET_THREAD();
+    rb_control_frame_t **frames;
+    rb_control_frame_t *end_cfp;
+    snapshot_buf_t buf;
+    snapshot_t *snapshot;
+    int i, n;
+
+    end_cfp = debug_context->start_cfp ? debug_context->start_cfp
+                                       : RUBY_VM_END_CONTROL_FRAME(th) - 1;
+    frames = ALLOC_N(rb_control_frame_t *, breakpoint->max_depth);
+    n = walk_frames(cfp, end_cfp, frames, breakpoint->max_depth);
+
+    buf.buf = ALLOC_N(char, breakpoint->max_bytes);
+    buf.len = 0;
+    buf.max = breakpoint->max_bytes;
+    buf.truncated = 0;
+    for(i = 0; i < n && !buf.truncated; i++)
+        buf_cat_frame(&buf, i, frames[i]);
+    xfree(frames);
+
+    snapshot = (snapshot_t *)xmalloc(sizeof(snapshot_t) + buf.len);
+    snapshot->next = NULL;
+    snapshot->id = ++snapshot_count;
+    snapshot->breakpoint_id = breakpoint->id;
+    snapshot->thnum = debug_context->thnum;
+    snapshot->time = time(NULL);
+    snapshot->file = ALLOC_N(char, strlen(file) + 1);
+    strcpy(snapshot->file, file);
+    snapshot->line = line;
+    snapshot->truncated = buf.truncated;
+    snapshot->len = buf.len;
+    memcpy(snapshot->text, buf.buf, buf.len);
+    snapshot->text[buf.len] = '\0';
+    xfree(buf.buf);
+    snapshot_store(snapshot);
+}
+
+static VALUE
+snapshot_to_hash(snapshot_t *snapshot)
+{
+    VALUE hash = rb_hash_new();
+
+    rb_hash_aset(hash, ID2SYM(rb_intern("id")), INT2FIX(snapshot->id));
+    rb_hash_aset(hash, ID2SYM(rb_intern("breakpoint")), INT2FIX(snapshot->breakpoint_id));
+    rb_hash_aset(hash, ID2SYM(rb_intern("thnum")), INT2FIX(snapshot->thnum));
+    rb_hash_aset(hash, ID2SYM(rb_intern("time")), rb_time_new(snapshot->time, 0));
+    rb_hash_aset(hash, ID2SYM(rb_intern("file")), rb_str_new2(snapshot->file));
+    rb_hash_aset(hash, ID2SYM(rb_intern("line")), INT2FIX(snapshot->line));
+    rb_hash_aset(hash, ID2SYM(rb_intern("text")), rb_str_new(snapshot->text, snapshot->len));
+    rb_hash_aset(hash, ID2SYM(rb_intern("truncated")), snapshot->truncated ? Qtrue : Qfalse);
+    return hash;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.snapshots -> array
+ *
+ *   Returns the snapshots taken by snapshot points, oldest first, as
+ *   hashes with keys :id, :breakpoint (the id of the snapshot point),
+ *   :thnum, :time, :file, :line, :text and :truncated (true if the
+ *   text was cut at the point's max_bytes).
+ */
+static VALUE
+debug_snapshots(VALUE self)
+{
+    VALUE result = rb_ary_new();
+    snapshot_t *snapshot;
+
+    for(snapshot = snapshots_head; snapshot; snapshot = snapshot->next)
+        rb_ary_push(result, snapshot_to_hash(snapshot));
+    return result;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.clear_snapshots -> nil
+ *
+ *   Drops every snapshot taken.
+ */
+static VALUE
+debug_clear_snapshots(VALUE self)
+{
+    while(snapshots_head)
+    {
+        snapshot_t *snapshot = snapshots_head;
+        snapshots_head = snapshot->next;
+        snapshot_free(snapshot);
+    }
+    snapshots_tail = NULL;
+    snapshots_size = 0;
+    return Qnil;
+}
+
+void
+Init_snapshot()
+{
+    rb_define_module_function(mDebugger, "snapshots", debug_snapshots, 0);
+    rb_define_module_function(mDebugger, "clear_snapshots", debug_clear_snapshots, 0);
+}
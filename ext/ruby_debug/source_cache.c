@@ -0,0 +1,311 @@
+#include <ruby.h>
+#include <ruby/util.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#include <vm_core.h>
+#include <iseq.h>
+#include "ruby_debug.h"
+
+/*
+ * A source file as seen by the debugger: its contents (mapped when
+ * the platform supports it) and the offset at which each line starts.
+ * offsets[nlines] is the file size, so line n (1-based) spans
+ * offsets[n-1] .. offsets[n].
+ */
+typedef struct {
+    char *data;
+    size_t size;
+    int mapped;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    time_t ctime;
+    long mtime_ns;        /* the fractions, where stat has them */
+    long ctime_ns;
+    int checked;          /* source_stop when the file was last stat'ed */
+    unsigned int nlines;
+    unsigned int *offsets;
+} source_file_t;
+
+static VALUE mSourceCache;
+static st_table *source_files = NULL;
+static int source_stop = 0;  /* counts stops, see source_cache_expire */
+
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+#define STAT_MTIME_NS(st) ((st)->st_mtim.tv_nsec)
+#define STAT_CTIME_NS(st) ((st)->st_ctim.tv_nsec)
+#else
+#define STAT_MTIME_NS(st) 0L
+#define STAT_CTIME_NS(st) 0L
+#endif
+
+static void
+source_file_free(source_file_t *source)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if(source->mapped)
+        munmap(source->data, source->size);
+    else
+#endif
+    if(source->data)
+        xfree(source->data);
+    xfree(source->offsets);
+    xfree(source);
+}
+
+static char *
+source_file_read(int fd, size_t size, int *mapped)
+{
+    char *data;
+    size_t done;
+    ssize_t n;
+
+#ifdef HAVE_SYS_MMAN_H
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data != MAP_FAILED)
+    {
+        *mapped = 1;
+        return data;
+    }
+#endif
+    *mapped = 0;
+    data = ALLOC_N(char, size);
+    for(done = 0; done < size; done += n)
+    {
+        n = read(fd, data + done, size - done);
+        if(n <= 0)
+        {
+            xfree(data);
+            return NULL;
+        }
+    }
+    return data;
+}
+
+static source_file_t *
+source_file_load(const char *path)
+{
+    source_file_t *source;
+    struct stat st;
+    unsigned int i, line;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return NULL;
+    /* offsets are 32 bits to keep the index small */
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+       (unsigned long long)st.st_size >= 0xffffffffULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    source = ALLOC(source_file_t);
+    source->size = (size_t)st.st_size;
+    source->dev = st.st_dev;
+    source->ino = st.st_ino;
+    source->mtime = st.st_mtime;
+    source->ctime = st.st_ctime;
+    source->mtime_ns = STAT_MTIME_NS(&st);
+    source->ctime_ns = STAT_CTIME_NS(&st);
+    source->checked = source_stop;
+    source->data = NULL;
+    source->mapped = 0;
+    if(source->size > 0)
+    {
+        source->data = source_file_read(fd, source->size, &source->mapped);
+        if(source->data == NULL)
+        {
+            close(fd);
+            xfree(source);
+            return NULL;
+        }
+    }
+    close(fd);
+
+    source->nlines = 0;
+    for(i = 0; i < source->size; i++)
+        if(source->data[i] == '\n')
+            source->nlines++;
+    if(source->size > 0 && source->data[source->size - 1] != '\n')
+        source->nlines++;
+
+    source->offsets = ALLOC_N(unsigned int, source->nlines + 1);
+    source->offsets[0] = 0;
+    for(i = 0, line = 1; i < source->size; i++)
+        if(source->data[i] == '\n' && line < source->nlines)
+            source->offsets[line++] = i + 1;
+    source->offsets[source->nlines] = (unsigned int)source->size;
+    return source;
+}
+
+/*
+ * Returns true if the file of +source+ is still the one that was read:
+ * same file, size and times.
+ */
+static int
+source_file_unchanged(source_file_t *source, const struct stat *st)
+{
+    return st->st_dev == source->dev && st->st_ino == source->ino &&
+        st->st_mtime == source->mtime && st->st_ctime == source->ctime &&
+        STAT_MTIME_NS(st) == source->mtime_ns && STAT_CTIME_NS(st) == source->ctime_ns &&
+        (size_t)st->st_size == source->size;
+}
+
+/*
+ * Returns the cached entry for +path+, loading it if necessary. Files
+ * are stat'ed at most once between two stops of the debugger, see
+ * source_cache_expire. When +reload+ is true a file changed since it
+ * was loaded is read again. A mapped file that has shrunk is always
+ * read again, since touching the part of the mapping past its new end
+ * would fault.
+ */
+static source_file_t *
+source_file_get(VALUE path, VALUE reload)
+{
+    source_file_t *source = NULL;
+    st_data_t key = (st_data_t)RSTRING_PTR(path);
+    struct stat st;
+
+    if(st_lookup(source_files, key, (st_data_t *)&source))
+    {
+        if(source->checked == source_stop || (!RTEST(reload) && !source->mapped))
+            return source;
+        if(stat(RSTRING_PTR(path), &st) == 0 &&
+           (RTEST(reload) ? source_file_unchanged(source, &st) :
+            st.st_ino != source->ino || (size_t)st.st_size >= source->size))
+        {
+            source->checked = source_stop;
+            return source;
+        }
+        st_delete(source_files, &key, (st_data_t *)&source);
+        xfree((char *)key);
+        source_file_free(source);
+    }
+    source = source_file_load(RSTRING_PTR(path));
+    if(source)
+        st_insert(source_files, (st_data_t)ruby_strdup(RSTRING_PTR(path)),
+                  (st_data_t)source);
+    return source;
+}
+
+/*
+ * Called when the debugger stops: files are checked again the next
+ * time they are looked up.
+ */
+void
+source_cache_expire()
+{
+    source_stop++;
+}
+
+static int
+source_file_free_i(st_data_t key, st_data_t value, st_data_t arg)
+{
+    xfree((char *)key);
+    source_file_free((source_file_t *)value);
+    return ST_DELETE;
+}
+
+/*
+ *   call-seq:
+ *      Debugger::SourceCache.line(file, n, reload = false) -> string or nil
+ *
+ *   Returns line +n+ (counting from 1) of +file+ including its newline,
+ *   or nil if the file can't be read or has no such line. Only the
+ *   requested line is copied into a string; the file itself stays
+ *   mapped. If +reload+ is true, a file changed since it was cached is
+ *   read again; files are checked once each time the debugger stops.
+ */
+static VALUE
+source_cache_line(int argc, VALUE *argv, VALUE self)
+{
+    VALUE path, n, reload;
+    source_file_t *source;
+    long line;
+
+    rb_scan_args(argc, argv, "21", &path, &n, &reload);
+    StringValue(path);
+    line = NUM2LONG(n);
+    source = source_file_get(path, reload);
+    if(source == NULL || line < 1 || line > (long)source->nlines)
+        return Qnil;
+    return rb_external_str_new(source->data + source->offsets[line - 1],
+        source->offsets[line] - source->offsets[line - 1]);
+}
+
+/*
+ *   call-seq:
+ *      Debugger::SourceCache.size(file, reload = false) -> int or nil
+ *
+ *   Returns the number of lines in +file+, or nil if it can't be read.
+ */
+static VALUE
+source_cache_size(int argc, VALUE *argv, VALUE self)
+{
+    VALUE path, reload;
+    source_file_t *source;
+
+    rb_scan_args(argc, argv, "11", &path, &reload);
+    StringValue(path);
+    source = source_file_get(path, reload);
+    return source ? UINT2NUM(source->nlines) : Qnil;
+}
+
+/*
+ *   call-seq:
+ *      Debugger::SourceCache.expire -> nil
+ *
+ *   Has every cached file checked for changes the next time it is
+ *   looked up, as happens each time the debugger stops.
+ */
+static VALUE
+source_cache_expire_m(VALUE self)
+{
+    source_cache_expire();
+    return Qnil;
+}
+
+/*
+ *   call-seq:
+ *      Debugger::SourceCache.clear -> nil
+ *
+ *   Drops every cached file.
+ */
+static VALUE
+source_cache_clear(VALUE self)
+{
+    st_foreach(source_files, source_file_free_i, 0);
+    return Qnil;
+}
+
+/*
+ *   Document-class: SourceCache
+ *
+ *   == Summary
+ *
+ *   Source lines shown by the debugger. Files are memory-mapped and
+ *   indexed by line offset, so showing a line of a large file doesn't
+ *   keep the whole file around as an array of strings.
+ */
+void
+Init_source_cache()
+{
+    mSourceCache = rb_define_module_under(mDebugger, "SourceCache");
+    rb_define_module_function(mSourceCache, "line", source_cache_line, -1);
+    rb_define_module_function(mSourceCache, "size", source_cache_size, -1);
+    rb_define_module_function(mSourceCache, "expire", source_cache_expire_m, 0);
+    rb_define_module_function(mSourceCache, "clear", source_cache_clear, 0);
+    source_files = st_init_strtable();
+}
@@ -0,0 +1,431 @@
+#include <ruby.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <vm_core.h>
+#include <iseq.h>
+#include "ruby_debug.h"
+
+/*
+ * The timeline. While it runs, every method call and return, Ruby or
+ * C, is appended with its time to a buffer for the thread that made
+ * it, and Debugger.timeline_dump writes them out as Chrome trace-event
+ * JSON (chrome://tracing, Perfetto), one track per thread, so it shows
+ * how threads interleave and when the interpreter lock changes hands.
+ * Where the VM counts garbage collections, each shows as a marker at
+ * the first call or return after it.
+ *
+ * Method names are kept as (class, method id) pairs in a table and
+ * only turned into strings when dumped. A method left by an exception
+ * doesn't report a return; the dump ends it when a shallower frame is
+ * seen.
+ */
+
+#define TIMELINE_DEFAULT_MAX 1000000 /* events kept per thread */
+
+typedef struct {
+    VALUE klass;
+    ID mid;
+    int index;
+} timeline_name_t;
+
+typedef struct {
+    double time;
+    int name;      /* index in names; -1 for a garbage collection */
+    int depth;     /* frames on the stack */
+    char phase;    /* 'B' for a call, 'E' for a return, 'i' for a GC */
+} timeline_event_t;
+
+struct timeline_buffer {
+    struct timeline_buffer *next;
+    int thnum;
+    long count;
+    long capa;
+    long dropped;
+    timeline_event_t *events;
+};
+
+int timeline_on = 0;
+int timeline_generation = 0;
+
+static timeline_buffer_t *buffers = NULL;
+static long max_events = TIMELINE_DEFAULT_MAX;
+static double origin = 0.0;
+static st_table *name_table = NULL;      /* timeline_name_t -> itself */
+static timeline_name_t **names = NULL;   /* by index */
+static int name_count = 0, name_capa = 0;
+static VALUE names_holder = Qnil;        /* marks the classes in names */
+#ifdef HAVE_RB_GC_COUNT
+static size_t last_gc_count = 0;
+#endif
+
+static int
+name_compare(st_data_t a, st_data_t b)
+{
+    timeline_name_t *x = (timeline_name_t *)a, *y = (timeline_name_t *)b;
+    return x->klass != y->klass || x->mid != y->mid;
+}
+
+static st_index_t
+name_hash(st_data_t a)
+{
+    timeline_name_t *name = (timeline_name_t *)a;
+    return (st_index_t)name->klass ^ ((st_index_t)name->mid * 31);
+}
+
+static const struct st_hash_type name_hash_type = {
+    name_compare,
+    name_hash,
+};
+
+static void
+names_mark(void *data)
+{
+    int i;
+
+    for(i = 0; i < name_count; i++)
+        rb_gc_mark(names[i]->klass);
+}
+
+static int
+name_index(VALUE klass, ID mid)
+{
+    timeline_name_t key, *name;
+    st_data_t found;
+
+    key.klass = klass;
+    key.mid = mid;
+    if(st_lookup(name_table, (st_data_t)&key, &found))
+        return ((timeline_name_t *)found)->index;
+    if(name_count == name_capa)
+    {
+        name_capa = name_capa ? name_capa * 2 : 256;
+        REALLOC_N(names, timeline_name_t *, name_capa);
+    }
+    name = ALLOC(timeline_name_t);
+    *name = key;
+    name->index = name_count;
+    names[name_count++] = name;
+    st_insert(name_table, (st_data_t)name, (st_data_t)name);
+    return name->index;
+}
+
+static void
+timeline_clear()
+{
+    timeline_buffer_t *buffer, *next;
+    int i;
+
+    for(buffer = buffers; buffer != NULL; buffer = next)
+    {
+        next = buffer->next;
+        xfree(buffer->events);
+        xfree(buffer);
+    }
+    buffers = NULL;
+    st_clear(name_table);
+    for(i = 0; i < name_count; i++)
+        xfree(names[i]);
+    name_count = 0;
+    timeline_generation++;
+}
+
+static timeline_buffer_t *
+timeline_buffer_get(debug_context_t *debug_context)
+{
+    timeline_buffer_t *buffer = debug_context->timeline;
+
+    if(buffer != NULL && debug_context->timeline_generation == timeline_generation)
+        return buffer;
+    buffer = ALLOC(timeline_buffer_t);
+    buffer->thnum = debug_context->thnum;
+    buffer->count = 0;
+    buffer->capa = 0;
+    buffer->dropped = 0;
+    buffer->events = NULL;
+    buffer->next = buffers;
+    buffers = buffer;
+    debug_context->timeline = buffer;
+    debug_context->timeline_generation = timeline_generation;
+    return buffer;
+}
+
+static void
+timeline_add(timeline_buffer_t *buffer, char phase, int name, int depth, double time)
+{
+    timeline_event_t *event;
+
+    if(buffer->count == buffer->capa)
+    {
+        if(buffer->capa >= max_events)
+        {
+            buffer->dropped++;
+            return;
+        }
+        buffer->capa = buffer->capa ? buffer->capa * 2 : 1024;
+        if(buffer->capa > max_events)
+            buffer->capa = max_events;
+        REALLOC_N(buffer->events, timeline_event_t, buffer->capa);
+    }
+    event = &buffer->events[buffer->count++];
+    event->time = time;
+    event->name = name;
+    event->depth = depth;
+    event->phase = phase;
+}
+
+/*
+ * Records a call or return of the thread of +debug_context+. Called
+ * from the event hook for TIMELINE_EVENTS; +mid+ and +klass+ are the
+ * hook's, which name the method for C calls only.
+ */
+void
+timeline_record(debug_context_t *debug_context, rb_event_flag_t event, ID mid, VALUE klass)
+{
+    rb_thread_t *th = GET_THREAD();
+    timeline_buffer_t *buffer = timeline_buffer_get(debug_context);
+    double now = wall_clock();
+    int depth = (int)(RUBY_VM_END_CONTROL_FRAME(th) - th->cfp);
+
+#ifdef HAVE_RB_GC_COUNT
+    {
+        size_t gc_count = rb_gc_count();
+
+        if(gc_count != last_gc_count)
+        {
+            last_gc_count = gc_count;
+            timeline_add(buffer, 'i', -1, depth, now);
+        }
+    }
+#endif
+    if(event & (RUBY_EVENT_C_CALL | RUBY_EVENT_C_RETURN))
+        /* the hook runs in the caller's frame; count the C method's */
+        depth++;
+    else if(th->cfp->iseq != NULL)
+    {
+        mid = th->cfp->iseq->defined_method_id;
+        klass = th->cfp->iseq->klass;
+    }
+    timeline_add(buffer, event & (RUBY_EVENT_CALL | RUBY_EVENT_C_CALL) ? 'B' : 'E',
+        name_index(klass, mid), depth, now);
+}
+
+/* Writes +str+ as a JSON string. */
+static void
+write_json_string(FILE *out, const char *str, long len)
+{
+    long i;
+
+    fputc('"', out);
+    for(i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)str[i];
+
+        if(c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if(c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/* "Foo#bar" for an instance method, "Foo.bar" for a singleton method. */
+static VALUE
+method_label(timeline_name_t *name)
+{
+    VALUE klass = name->klass, label = Qnil;
+    const char *separator = "#";
+
+    if(klass && TYPE(klass) == T_ICLASS)
+        klass = RBASIC(klass)->klass;
+    if(klass && FL_TEST(klass, FL_SINGLETON))
+    {
+        klass = rb_iv_get(klass, "__attached__");
+        separator = ".";
+    }
+    if(klass && (TYPE(klass) == T_CLASS || TYPE(klass) == T_MODULE))
+        label = rb_mod_name(klass);
+    else if(klass)
+        label = rb_str_new2(rb_obj_classname(klass));
+    label = NIL_P(label) ? rb_str_new2("") : rb_str_dup(label);
+    rb_str_cat2(label, separator);
+    rb_str_cat2(label, name->mid ? rb_id2name(name->mid) : "<main>");
+    return label;
+}
+
+static void
+write_event(FILE *out, VALUE *labels, int pid, int thnum, char phase, int name,
+    double time)
+{
+    fputs(",\n{\"name\":", out);
+    if(name < 0)
+        fputs("\"GC\"", out);
+    else
+        write_json_string(out, RSTRING_PTR(labels[name]), RSTRING_LEN(labels[name]));
+    fprintf(out, ",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+        name < 0 ? "gc" : "ruby", phase, (time - origin) * 1e6, pid, thnum);
+    if(phase == 'i')
+        fputs(",\"s\":\"g\"", out);
+    fputc('}', out);
+}
+
+/*
+ * Writes the events of +buffer+, ending the calls a return wasn't
+ * recorded for: those at or below the depth of a later event.
+ */
+static void
+write_buffer(FILE *out, VALUE *labels, int pid, timeline_buffer_t *buffer)
+{
+    timeline_event_t *open;
+    long i, top = 0;
+    double last = origin;
+
+    fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+        "\"args\":{\"name\":\"Thread %d\"}}", pid, buffer->thnum, buffer->thnum);
+    open = ALLOC_N(timeline_event_t, buffer->count + 1);
+    for(i = 0; i < buffer->count; i++)
+    {
+        timeline_event_t *event = &buffer->events[i];
+
+        last = event->time;
+        if(event->phase == 'i')
+        {
+            write_event(out, labels, pid, buffer->thnum, 'i', -1, event->time);
+            continue;
+        }
+        while(top > 0 && (open[top-1].depth > event->depth ||
+              (event->phase == 'B' && open[top-1].depth == event->depth)))
+        {
+            top--;
+            write_event(out, labels, pid, buffer->thnum, 'E', open[top].name, event->time);
+        }
+        if(event->phase == 'B')
+        {
+            write_event(out, labels, pid, buffer->thnum, 'B', event->name, event->time);
+            open[top++] = *event;
+        }
+        else if(top > 0)
+        {
+            top--;
+            write_event(out, labels, pid, buffer->thnum, 'E', open[top].name, event->time);
+        }
+    }
+    while(top > 0)
+    {
+        top--;
+        write_event(out, labels, pid, buffer->thnum, 'E', open[top].name, last);
+    }
+    xfree(open);
+}
+
+/*
+ *   call-seq:
+ *      Debugger.timeline_start(max_events = 1000000) -> true
+ *
+ *   Starts recording the calls and returns of every thread, dropping
+ *   what was recorded before. At most +max_events+ are kept for each
+ *   thread.
+ */
+static VALUE
+debug_timeline_start(int argc, VALUE *argv, VALUE self)
+{
+    VALUE max;
+
+    rb_scan_args(argc, argv, "01", &max);
+    max_events = NIL_P(max) ? TIMELINE_DEFAULT_MAX : NUM2LONG(max);
+    if(max_events <= 0)
+        rb_raise(rb_eArgError, "max_events must be positive");
+    timeline_clear();
+    origin = wall_clock();
+#ifdef HAVE_RB_GC_COUNT
+    last_gc_count = rb_gc_count();
+#endif
+    timeline_on = 1;
+    rdebug_install_hook();
+    return Qtrue;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.timeline_stop -> nil
+ *
+ *   Stops recording, removing the event hook if the debugger is off.
+ *   What was recorded is kept for Debugger.timeline_dump.
+ */
+static VALUE
+debug_timeline_stop(VALUE self)
+{
+    timeline_on = 0;
+    rdebug_release_hook();
+    return Qnil;
+}
+
+typedef struct {
+    FILE *out;
+    VALUE labels;  /* method_label of each name */
+} timeline_dump_t;
+
+static VALUE
+timeline_dump_file(VALUE arg)
+{
+    timeline_dump_t *dump = (timeline_dump_t *)arg;
+    FILE *out = dump->out;
+    VALUE labels = dump->labels;
+    timeline_buffer_t *buffer;
+    int pid = (int)getpid();
+    long dropped = 0;
+    int i;
+
+    for(i = 0; i < name_count; i++)
+        rb_ary_push(labels, method_label(names[i]));
+    fprintf(out, "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\","
+        "\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"ruby\"}}", pid);
+    for(buffer = buffers; buffer != NULL; buffer = buffer->next)
+    {
+        write_buffer(out, RARRAY_PTR(labels), pid, buffer);
+        dropped += buffer->dropped;
+    }
+    fprintf(out, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%ld}}\n",
+        dropped);
+    return Qnil;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.timeline_dump(path) -> path
+ *
+ *   Writes what the timeline recorded to +path+ as Chrome trace-event
+ *   JSON, for chrome://tracing or Perfetto.
+ */
+static VALUE
+debug_timeline_dump(VALUE self, VALUE path)
+{
+    timeline_dump_t dump;
+    int state;
+
+    StringValue(path);
+    dump.out = fopen(RSTRING_PTR(path), "w");
+    if(dump.out == NULL)
+        rb_sys_fail(RSTRING_PTR(path));
+    dump.labels = rb_ary_new();
+    rb_protect(timeline_dump_file, (VALUE)&dump, &state);
+    fclose(dump.out);
+    if(state)
+        rb_jump_tag(state);
+    return path;
+}
+
+void
+Init_timeline()
+{
+    rb_define_module_function(mDebugger, "timeline_start", debug_timeline_start, -1);
+    rb_define_module_function(mDebugger, "timeline_stop", debug_timeline_stop, 0);
+    rb_define_module_function(mDebugger, "timeline_dump", debug_timeline_dump, 1);
+    name_table = st_init_table(&name_hash_type);
+    names_holder = Data_Wrap_Struct(rb_cObject, names_mark, 0, 0);
+    rb_global_variable(&names_holder);
+}
@@ -0,0 +1,247 @@
+#include <ruby.h>
+#include <string.h>
+#include <vm_core.h>
+#include <iseq.h>
+#include "ruby_debug.h"
+
+/*
+ * Trace filters: which lines line tracing reports. A line is traced if
+ * its file matches one of the include globs (when there are any) and
+ * none of the exclude globs, its method matches one of the method
+ * patterns (when there are any) and it is no more than max_depth
+ * frames deeper than where tracing started in its thread.
+ *
+ * All but the depth depend only on the iseq, so they are worked out
+ * the first time an iseq is traced and kept in its index's flags, see
+ * iseq_traced.
+ */
+
+int trace_filter_on = 0;
+int trace_max_depth = 0;     /* 0 for no limit */
+
+static VALUE includes = Qnil;
+static VALUE excludes = Qnil;
+static VALUE methods = Qnil;
+
+static ID id_include, id_exclude, id_methods, id_max_depth;
+
+/*
+ * Matches +str+ against the glob +pattern+, where * matches any run of
+ * characters, / included, and ? any one character.
+ */
+static int
+glob_match(const char *pattern, const char *str)
+{
+    const char *star = NULL, *resume = NULL;
+
+    while(*str)
+    {
+        if(*pattern == '*')
+        {
+            star = pattern++;
+            resume = str;
+        }
+        else if(*pattern == '?' || *pattern == *str)
+        {
+            pattern++;
+            str++;
+        }
+        else if(star)
+        {
+            pattern = star + 1;
+            str = ++resume;
+        }
+        else
+            return 0;
+    }
+    while(*pattern == '*')
+        pattern++;
+    return *pattern == '\0';
+}
+
+static int
+any_match(VALUE patterns, const char *str)
+{
+    int i;
+
+    for(i = 0; i < RARRAY_LEN(patterns); i++)
+        if(glob_match(RSTRING_PTR(RARRAY_PTR(patterns)[i]), str))
+            return 1;
+    return 0;
+}
+
+/*
+ * Matches the method of +iseq+ against the method patterns: "Foo#bar"
+ * for an instance method, "Foo.bar" for a singleton method, or a class
+ * name alone for any method of the class.
+ */
+static int
+method_match(const rb_iseq_t *iseq)
+{
+    const rb_iseq_t *method_iseq = iseq->local_iseq ? iseq->local_iseq : iseq;
+    VALUE klass = method_iseq->klass, name, full;
+    const char *separator = "#";
+    int i;
+
+    if(klass && FL_TEST(klass, FL_SINGLETON))
+    {
+        klass = rb_iv_get(klass, "__attached__");
+        separator = ".";
+    }
+    name = klass && (TYPE(klass) == T_CLASS || TYPE(klass) == T_MODULE) ?
+        rb_mod_name(klass) : Qnil;
+    if(NIL_P(name))
+        name = rb_str_new2("");
+    full = rb_str_dup(name);
+    rb_str_cat2(full, separator);
+    if(TYPE(method_iseq->name) == T_STRING)
+        rb_str_append(full, method_iseq->name);
+
+    for(i = 0; i < RARRAY_LEN(methods); i++)
+    {
+        const char *pattern = RSTRING_PTR(RARRAY_PTR(methods)[i]);
+
+        if(strchr(pattern, '#') || strchr(pattern, '.') ?
+           glob_match(pattern, RSTRING_PTR(full)) :
+           glob_match(pattern, RSTRING_PTR(name)))
+            return 1;
+    }
+    return 0;
+}
+
+/* Returns true if lines of +iseq+ pass the file and method filters. */
+int
+trace_filter_match(const rb_iseq_t *iseq)
+{
+    const char *file;
+
+    if(TYPE(iseq->filename) != T_STRING)
+        return 1;
+    file = RSTRING_PTR(iseq->filename);
+    if(RARRAY_LEN(includes) > 0 && !any_match(includes, file))
+        return 0;
+    if(any_match(excludes, file))
+        return 0;
+    if(RARRAY_LEN(methods) > 0 && !method_match(iseq))
+        return 0;
+    return 1;
+}
+
+/*
+ * Returns true if the line of frame +cfp+ of the thread of
+ * +debug_context+ is to be traced.
+ */
+int
+trace_filter_check(debug_context_t *debug_context, rb_thread_t *th, rb_control_frame_t *cfp)
+{
+    if(!iseq_traced(cfp->iseq))
+        return 0;
+    if(trace_max_depth > 0)
+    {
+        int depth = (int)(RUBY_VM_END_CONTROL_FRAME(th) - cfp);
+
+        if(debug_context->trace_base == 0)
+            debug_context->trace_base = depth;
+        if(depth - debug_context->trace_base > trace_max_depth)
+            return 0;
+    }
+    return 1;
+}
+
+static VALUE
+string_list(VALUE value)
+{
+    VALUE list = rb_ary_new();
+    int i;
+
+    if(NIL_P(value))
+        return list;
+    value = rb_Array(value);
+    for(i = 0; i < RARRAY_LEN(value); i++)
+    {
+        VALUE str = rb_obj_as_string(RARRAY_PTR(value)[i]);
+        rb_ary_push(list, rb_obj_freeze(rb_str_dup(str)));
+    }
+    return list;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.trace_filter -> hash or nil
+ *
+ *   Returns the trace filters as Debugger.trace_filter= takes them, nil
+ *   if every line is traced.
+ */
+static VALUE
+debug_trace_filter(VALUE self)
+{
+    VALUE hash;
+
+    if(!trace_filter_on)
+        return Qnil;
+    hash = rb_hash_new();
+    rb_hash_aset(hash, ID2SYM(id_include), rb_ary_dup(includes));
+    rb_hash_aset(hash, ID2SYM(id_exclude), rb_ary_dup(excludes));
+    rb_hash_aset(hash, ID2SYM(id_methods), rb_ary_dup(methods));
+    rb_hash_aset(hash, ID2SYM(id_max_depth),
+        trace_max_depth > 0 ? INT2FIX(trace_max_depth) : Qnil);
+    return hash;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.trace_filter = hash or nil
+ *
+ *   Sets which lines line tracing reports. The hash may have
+ *   :include and :exclude, globs of file names where * matches any
+ *   characters, / included; :methods, patterns such as "Foo#bar",
+ *   "Foo.bar" or "Foo::*"; and :max_depth, how many frames deeper than
+ *   where tracing started in a thread lines are still traced. With nil
+ *   every line is traced.
+ */
+static VALUE
+debug_set_trace_filter(VALUE self, VALUE filter)
+{
+    VALUE include = Qnil, exclude = Qnil, method = Qnil, depth = Qnil;
+    int max_depth;
+
+    if(!NIL_P(filter))
+    {
+        Check_Type(filter, T_HASH);
+        include = rb_hash_aref(filter, ID2SYM(id_include));
+        exclude = rb_hash_aref(filter, ID2SYM(id_exclude));
+        method = rb_hash_aref(filter, ID2SYM(id_methods));
+        depth = rb_hash_aref(filter, ID2SYM(id_max_depth));
+    }
+    max_depth = NIL_P(depth) ? 0 : NUM2INT(depth);
+    include = string_list(include);
+    exclude = string_list(exclude);
+    method = string_list(method);
+
+    includes = include;
+    excludes = exclude;
+    methods = method;
+    trace_max_depth = max_depth > 0 ? max_depth : 0;
+    trace_filter_on = RARRAY_LEN(includes) > 0 || RARRAY_LEN(excludes) > 0 ||
+        RARRAY_LEN(methods) > 0 || trace_max_depth > 0;
+    iseq_index_forget_traced();
+    rdebug_reset_trace_base();
+    return filter;
+}
+
+void
+Init_trace_filter()
+{
+    rb_define_module_function(mDebugger, "trace_filter", debug_trace_filter, 0);
+    rb_define_module_function(mDebugger, "trace_filter=", debug_set_trace_filter, 1);
+    id_include = rb_intern("include");
+    id_exclude = rb_intern("exclude");
+    id_methods = rb_intern("methods");
+    id_max_depth = rb_intern("max_depth");
+    includes = rb_ary_new();
+    excludes = rb_ary_new();
+    methods = rb_ary_new();
+    rb_global_variable(&includes);
+    rb_global_variable(&excludes);
+    rb_global_variable(&methods);
+}
@@ -0,0 +1,277 @@
+#include <ruby.h>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#include <vm_core.h>
+#include <iseq.h>
+#include "ruby_debug.h"
+
+/*
+ * The trace sink. When Debugger.trace_file is set, line tracing doesn't
+ * call Context#at_tracing but appends a binary record to a ring buffer,
+ * which a writer thread copies to the file. Only the thread holding the
+ * interpreter lock adds records and only the writer removes them, so
+ * the buffer needs no lock: each side owns one of the two offsets.
+ * Debugger::TraceFile reads the file back.
+ *
+ * The file starts with TRACE_MAGIC followed by records of a one byte
+ * tag and 32-bit big-endian fields:
+ *
+ *   'F' id length name    a file name, numbered the first time it is seen
+ *   'L' thnum id line     a line traced
+ */
+
+#define TRACE_MAGIC       "RDBTRAC1"
+#define TRACE_BUFFER_SIZE (1 << 20) /* a power of 2 */
+#define TRACE_WRITER_IDLE 1000      /* microseconds the writer sleeps */
+
+static char *buffer = NULL;
+static volatile unsigned long head = 0; /* moved by the traced threads */
+static volatile unsigned long tail = 0; /* moved by the writer */
+static FILE *sink = NULL;
+static VALUE sink_path = Qnil;
+static st_table *file_ids = NULL;     /* file name string -> id */
+static VALUE file_names = Qnil;       /* keeps the names in file_ids */
+
+int trace_sink_on = 0;
+
+#if defined HAVE_PTHREAD_H && defined HAVE_UNISTD_H
+#define TRACE_WRITER_THREAD
+static pthread_t writer;
+static volatile int writer_running = 0;
+#endif
+
+#ifdef __GNUC__
+#define memory_barrier() __sync_synchronize()
+#else
+#define memory_barrier()
+#endif
+
+/* Copies what the buffer holds to the file. */
+static void
+drain()
+{
+    unsigned long end = head;
+
+    memory_barrier();
+    while(tail != end)
+    {
+        unsigned long start = tail & (TRACE_BUFFER_SIZE - 1);
+        unsigned long len = end - tail;
+
+        if(start + len > TRACE_BUFFER_SIZE)
+            len = TRACE_BUFFER_SIZE - start;
+        fwrite(buffer + start, 1, len, sink);
+        memory_barrier();
+        tail += len;
+    }
+}
+
+#ifdef TRACE_WRITER_THREAD
+static void *
+writer_main(void *arg)
+{
+    while(writer_running)
+    {
+        if(tail == head)
+        {
+            fflush(sink);
+            usleep(TRACE_WRITER_IDLE);
+        }
+        drain();
+    }
+    return NULL;
+}
+#endif
+
+/* Waits until +len+ bytes are free, draining here if there's no writer. */
+static void
+reserve(unsigned long len)
+{
+    while(TRACE_BUFFER_SIZE - (head - tail) < len)
+    {
+#ifdef TRACE_WRITER_THREAD
+        if(writer_running)
+        {
+            usleep(TRACE_WRITER_IDLE / 10);
+            continue;
+        }
+#endif
+        drain();
+    }
+}
+
+/*
+ * A record is put after head and head moved past it only once it is
+ * complete, so the writer never sees part of one.
+ */
+static unsigned long next; /* where put_byte puts the next byte */
+
+static void
+begin_record(unsigned long len)
+{
+    reserve(len);
+    next = head;
+}
+
+static void
+put_byte(int byte)
+{
+    buffer[next & (TRACE_BUFFER_SIZE - 1)] = (char)byte;
+    next++;
+}
+
+static void
+put_long(unsigned long value)
+{
+    put_byte((int)(value >> 24) & 0xff);
+    put_byte((int)(value >> 16) & 0xff);
+    put_byte((int)(value >> 8) & 0xff);
+    put_byte((int)value & 0xff);
+}
+
+static void
+end_record()
+{
+    memory_barrier();
+    head = next;
+}
+
+static unsigned long
+file_id(VALUE filename)
+{
+    st_data_t id;
+    long i, len;
+
+    if(st_lookup(file_ids, (st_data_t)filename, &id))
+        return (unsigned long)id;
+    id = (st_data_t)file_ids->num_entries + 1;
+    st_insert(file_ids, (st_data_t)filename, id);
+    rb_ary_push(file_names, filename);
+
+    len = RSTRING_LEN(filename);
+    begin_record(9 + len);
+    put_byte('F');
+    put_long((unsigned long)id);
+    put_long((unsigned long)len);
+    for(i = 0; i < len; i++)
+        put_byte(RSTRING_PTR(filename)[i]);
+    end_record();
+    return (unsigned long)id;
+}
+
+/*
+ * Records that thread +thnum+ runs +line+ of the file named by the
+ * string +filename+. Called from the event hook in place of
+ * Context#at_tracing.
+ */
+void
+trace_sink_line(int thnum, VALUE filename, int line)
+{
+    unsigned long id = file_id(filename);
+
+    begin_record(13);
+    put_byte('L');
+    put_long((unsigned long)thnum);
+    put_long(id);
+    put_long((unsigned long)line);
+    end_record();
+}
+
+static void
+trace_sink_close()
+{
+    if(sink == NULL)
+        return;
+    trace_sink_on = 0;
+#ifdef TRACE_WRITER_THREAD
+    if(writer_running)
+    {
+        writer_running = 0;
+        pthread_join(writer, NULL);
+    }
+#endif
+    drain();
+    fclose(sink);
+    sink = NULL;
+    sink_path = Qnil;
+}
+
+static void
+trace_sink_end_proc(VALUE unused)
+{
+    trace_sink_close();
+}
+
+/*
+ *   call-seq:
+ *      Debugger.trace_file = path or nil
+ *
+ *   Sends line tracing to the file +path+ in a compact binary form, see
+ *   Debugger::TraceFile, instead of to the trace handler; lines traced
+ *   are written out by a background thread. With nil, what is left is
+ *   written and the file is closed.
+ */
+static VALUE
+debug_set_trace_file(VALUE self, VALUE path)
+{
+    FILE *file = NULL;
+
+    if(!NIL_P(path))
+    {
+        StringValue(path);
+        file = fopen(RSTRING_PTR(path), "wb");
+        if(file == NULL)
+            rb_sys_fail(RSTRING_PTR(path));
+        path = rb_str_dup(path);
+    }
+    trace_sink_close();
+    if(file == NULL)
+        return path;
+
+    if(buffer == NULL)
+        buffer = ALLOC_N(char, TRACE_BUFFER_SIZE);
+    head = tail = 0;
+    st_clear(file_ids);
+    rb_ary_clear(file_names);
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), file);
+    sink = file;
+    sink_path = path;
+#ifdef TRACE_WRITER_THREAD
+    writer_running = 1;
+    if(pthread_create(&writer, NULL, writer_main, NULL) != 0)
+        writer_running = 0;
+#endif
+    trace_sink_on = 1;
+    return path;
+}
+
+/*
+ *   call-seq:
+ *      Debugger.trace_file -> path or nil
+ *
+ *   Returns the file line tracing is written to, nil if tracing goes
+ *   to the trace handler.
+ */
+static VALUE
+debug_trace_file(VALUE self)
+{
+    return sink_path;
+}
+
+void
+Init_trace_sink()
+{
+    rb_define_module_function(mDebugger, "trace_file", debug_trace_file, 0);
+    rb_define_module_function(mDebugger, "trace_file=", debug_set_trace_file, 1);
+    file_ids = st_init_numtable();
+    file_names = rb_ary_new();
+    rb_global_variable(&file_names);
+    rb_global_variable(&sink_path);
+    rb_set_end_proc(trace_sink_end_proc, Qnil);
+}
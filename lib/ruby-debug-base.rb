@@ -1,6 +1,8 @@
 require 'ruby_debug.so'
 require 'rubygems'
 require 'linecache19'
+require_relative 'ruby-debug-base/core_file'
+require_relative 'ruby-debug-base/trace_file'
 
 module Debugger
   
@@ -8,6 +10,7 @@ module Debugger
   DEFAULT_START_SETTINGS = { 
     :init        => true,  # Set $0 and save ARGV? 
     :post_mortem => false, # post-mortem debugging on uncaught exception?
+    :core_file   => nil,   # write a core file instead of stopping post-mortem
     :tracing     => nil    # Debugger.tracing value. true/false resets,
                            # nil keeps the prior value
   } unless defined?(DEFAULT_START_SETTINGS)
@@ -22,6 +25,11 @@ module Debugger
       __c_frame_binding(frame) || hbinding(frame)
     end
 
+    # Returns true if a core was written for +excpt+ in this context.
+    def core_written?(excpt)
+      @core_exception.equal?(excpt)
+    end
+
     private
 
     def hbinding(frame)
@@ -43,15 +51,33 @@ module Debugger
     end
 
     def at_catchpoint(excpt)
+      if Debugger.core_file and not caught_by_catchpoint?(excpt)
+        # An uncaught exception: record it, once however many frames
+        # it goes through, and let it propagate instead of stopping.
+        unless core_written?(excpt)
+          Debugger.write_core(self, excpt)
+          @core_exception = excpt
+        end
+        @core_written = true
+        return
+      end
       handler.at_catchpoint(self, excpt)
     end
 
+    def caught_by_catchpoint?(excpt)
+      !Debugger.catchpoint_for(excpt.class).nil?
+    end
+
     def at_tracing(file, line)
-      @tracing_started = true if File.identical?(file, File.join(Debugger::INITIAL_DIR, Debugger::PROG_SCRIPT))
+      @tracing_started ||= Debugger.program_file?(file)
       handler.at_tracing(self, file, line) if @tracing_started
     end
 
     def at_line(file, line)
+      if @core_written
+        @core_written = false
+        return
+      end
       handler.at_line(self, file, line)
     end
 
@@ -72,7 +98,28 @@ module Debugger
 
     attr_accessor :last_exception
     Debugger.last_exception = nil
+
+    # If set, uncaught exceptions are written to this core file (see
+    # CoreFile) instead of entering post-mortem mode, so the process
+    # can exit right away. A "%p" in the name is replaced by the pid.
+    attr_accessor :core_file
     
+    #
+    # Removes the debugger's event hook, so the program runs at full
+    # speed, until the process gets +signal+ (for example :USR2). The
+    # debugger is then started, along with its control server if
+    # ruby-debug is loaded, so a client can attach with "rdebug -c".
+    # Setting RDEBUG_ARM_SIGNAL in the environment does this when the
+    # extension is loaded, before the hook is ever installed.
+    #
+    def arm_on_signal(signal)
+      remove_hook
+      trap(signal) do
+        Debugger.start
+        Debugger.start_control if Debugger.respond_to?(:start_control)
+      end
+    end
+
     #
     # Interrupts the current thread
     #
@@ -92,14 +139,43 @@ module Debugger
     end
     
     def source_reload
+      SourceCache.clear
       LineCache::clear_file_cache
     end
+
+    # Get line +line_number+ from file named +filename+, or nil if
+    # there is no such line. Files are read through SourceCache;
+    # LineCache is used for sources it can't read, such as scripts
+    # only kept in SCRIPT_LINES__.
+    def source_line(filename, line_number) # :nodoc:
+      SourceCache.line(filename, line_number, reload_source_on_change) ||
+        LineCache::getline(filename, line_number, reload_source_on_change)
+    end
+
+    # Number of lines in the file named +filename+, or nil if it can't
+    # be read.
+    def source_size(filename) # :nodoc:
+      SourceCache.size(filename, reload_source_on_change) or begin
+        lines = LineCache::getlines(filename, reload_source_on_change)
+        lines && lines.size
+      end
+    end
     
+    # Whether +file+ is the program being debugged. File.identical? is
+    # asked once for each file name. Any file is, if no program was
+    # recorded by Debugger.start.
+    def program_file?(file) # :nodoc:
+      return true unless defined?(Debugger::PROG_SCRIPT)
+      @program_files ||= {}
+      return @program_files[file] if @program_files.has_key?(file)
+      @program_files[file] =
+        File.identical?(file, File.join(Debugger::INITIAL_DIR, Debugger::PROG_SCRIPT))
+    end
+
     # Get line +line_number+ from file named +filename+. Return "\n"
     # there was a problem. Leaking blanks are stripped off.
     def line_at(filename, line_number) # :nodoc:
-      @reload_on_change=nil unless defined?(@reload_on_change)
-      line = LineCache::getline(filename, line_number, @reload_on_change)
+      line = source_line(filename, line_number)
       return "\n" unless line
       return "#{line.gsub(/^\s+/, '').chomp}\n"
     end
@@ -149,6 +225,10 @@ module Debugger
     def handle_post_mortem(exp)
       return if !exp || !exp.__debug_context || 
         exp.__debug_context.stack_size == 0
+      if core_file
+        return if exp.__debug_context.core_written?(exp)
+        return write_core(exp.__debug_context, exp)
+      end
       Debugger.suspend
       orig_tracing = Debugger.tracing, Debugger.current_context.tracing
       Debugger.tracing = Debugger.current_context.tracing = false
@@ -159,6 +239,20 @@ module Debugger
       Debugger.resume
     end
     # private :handle_post_mortem
+
+    #
+    # Writes the frames of +context+ and +exception+ to a core file,
+    # by default the one named by Debugger.core_file.
+    #
+    def write_core(context, exception = nil, path = core_file)
+      path = path.gsub('%p', Process.pid.to_s)
+      CoreFile.write(path, context, exception)
+      $stderr.print "ruby-debug: core written to #{path}\n"
+      path
+    rescue SystemCallError, IOError => e
+      $stderr.print "ruby-debug: can't write core #{path}: #{e}\n"
+      nil
+    end
   end
   
   class DebugThread # :nodoc:
@@ -198,6 +292,8 @@ module Debugger
   # Set :post_mortem true if you want to enter post-mortem debugging
   # on an uncaught exception. Once post-mortem debugging is set, it can't
   # be unset.
+  # Set :core_file to a file name to have uncaught exceptions written
+  # there instead of stopping; see Debugger.core_file.
   def start(options={}, &block)
     options = Debugger::DEFAULT_START_SETTINGS.merge(options)
     if options[:init]
@@ -209,6 +305,7 @@ module Debugger
         defined? Debugger::INITIAL_DIR
     end
     Debugger.tracing = options[:tracing] unless options[:tracing].nil?
+    Debugger.core_file = options[:core_file] if options[:core_file]
     retval = Debugger.started? ? block && block.call(self) : Debugger.start_(&block) 
     if options[:post_mortem]
       post_mortem
@@ -262,6 +359,8 @@ module Kernel
   end
 end
 
+Debugger.arm_on_signal(ENV['RDEBUG_ARM_SIGNAL']) if ENV['RDEBUG_ARM_SIGNAL']
+
 class Exception # :nodoc:
   attr_reader :__debug_file, :__debug_line, :__debug_binding, :__debug_context
 end
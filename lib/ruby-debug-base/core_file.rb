@@ -0,0 +1,251 @@
+module Debugger
+  # Reads and writes post-mortem core files. A core file is a compact
+  # binary snapshot of a crashed context: the frames saved for
+  # post-mortem handling (file, line, method, class) and their local
+  # variables rendered to bounded strings. It lets a process record
+  # its state and exit instead of waiting for someone to attach.
+  #
+  # The file starts with MAGIC followed by a sequence of records. Each
+  # record is a one byte tag, a 32-bit big-endian payload length and
+  # the payload. Readers skip records with tags they don't know about.
+  module CoreFile
+    MAGIC   = "RDBCORE1" unless defined?(MAGIC)
+
+    # Longest string stored for a rendered value.
+    MAX_VALUE_SIZE = 256 unless defined?(MAX_VALUE_SIZE)
+    # Longest string stored for anything else (names, messages).
+    MAX_STRING_SIZE = 4096 unless defined?(MAX_STRING_SIZE)
+
+    TAG_HEADER = 'H' unless defined?(TAG_HEADER)
+    TAG_FRAME  = 'F' unless defined?(TAG_FRAME)
+    TAG_HISTORY = 'R' unless defined?(TAG_HISTORY)
+
+    # A local variable value as rendered at the time of the crash.
+    # +inspect+ returns the rendered string so it can be shown by the
+    # same code that shows live values.
+    class Value
+      def initialize(str)
+        @str = str
+      end
+
+      def inspect
+        @str
+      end
+      alias to_s inspect
+    end
+
+    Frame = Struct.new(:file, :line, :meth, :klass, :args, :locals) unless
+      defined?(Frame)
+
+    class << self
+      # Write the frames of +context+ and the +exception+ (which may be
+      # nil) that killed it to +path+.
+      def write(path, context, exception=nil)
+        File.open(path, 'wb') do |f|
+          f.write(MAGIC)
+          header = [Process.pid, Time.now.to_i, context.thnum].pack('NNN')
+          header << pack_str($0.to_s)
+          header << pack_str(exception ? exception.class.name.to_s : '')
+          header << pack_str(exception ? exception.message.to_s : '')
+          write_record(f, TAG_HEADER, header)
+          (0...context.stack_size).each do |i|
+            write_record(f, TAG_FRAME, pack_frame(context, i))
+          end
+          history = context.history rescue []
+          write_record(f, TAG_HISTORY, pack_history(history)) unless
+            history.empty?
+          yield f if block_given?
+        end
+        path
+      end
+
+      # Read a core file written by +write+.
+      def read(path)
+        data = File.open(path, 'rb') { |f| f.read }
+        unless data[0, MAGIC.size] == MAGIC
+          raise IOError, "#{path} is not a ruby-debug core file"
+        end
+        core = CoreContext.new
+        pos = MAGIC.size
+        while pos + 5 <= data.size
+          tag = data[pos, 1]
+          len = data[pos+1, 4].unpack('N')[0]
+          payload = data[pos+5, len]
+          pos += 5 + len
+          case tag
+          when TAG_HEADER
+            core.pid, core.time, core.thnum = payload.unpack('NNN')
+            off = 12
+            core.program, off = unpack_str(payload, off)
+            core.exception_class, off = unpack_str(payload, off)
+            core.exception_message, off = unpack_str(payload, off)
+          when TAG_FRAME
+            core.frames << unpack_frame(payload)
+          when TAG_HISTORY
+            core.recorded = unpack_history(payload)
+          else
+            core.records << [tag, payload]
+          end
+        end
+        core
+      end
+
+      # Render +value+ the way "info locals" would, bounded to +max+
+      # bytes. Rendering never raises.
+      def render(value, max=MAX_VALUE_SIZE)
+        str = begin
+                value.inspect.to_s
+              rescue Exception
+                begin
+                  "#<#{value.class} (inspect failed)>"
+                rescue Exception
+                  "*Error in evaluation*"
+                end
+              end
+        bound(str, max)
+      end
+
+      def pack_str(str, max=MAX_STRING_SIZE)
+        str = bound(str.to_s, max)
+        [str.bytesize].pack('N') + str
+      end
+
+      def unpack_str(data, off)
+        len = data[off, 4].unpack('N')[0]
+        [data[off+4, len], off + 4 + len]
+      end
+
+      private
+
+      def bound(str, max)
+        str = str.dup.force_encoding('BINARY') if str.respond_to?(:force_encoding)
+        str.bytesize > max ? str[0, max-3] + '...' : str
+      end
+
+      def write_record(f, tag, payload)
+        f.write(tag + [payload.bytesize].pack('N') + payload)
+      end
+
+      def pack_frame(context, i)
+        method = context.frame_method(i)
+        klass  = context.frame_class(i)
+        args   = context.frame_args(i) rescue []
+        locals = context.frame_locals(i) rescue {}
+        s = [context.frame_line(i).to_i].pack('N')
+        s << pack_str(context.frame_file(i))
+        s << pack_str(method ? method.to_s : '')
+        s << pack_str(klass ? klass.to_s : '')
+        s << [args.size].pack('N')
+        args.each { |name| s << pack_str(name) }
+        s << [locals.size].pack('N')
+        locals.each do |name, value|
+          s << pack_str(name) << pack_str(render(value), MAX_VALUE_SIZE)
+        end
+        s
+      end
+
+      # The flight recorder's history: the number of entries, then for
+      # each its line, depth, event (1 for a call), time and strings for
+      # the file and method.
+      def pack_history(history)
+        s = [history.size].pack('N')
+        history.each do |h|
+          s << [h[:line], h[:depth], h[:event] == :call ? 1 : 0].pack('NNN')
+          s << [h[:time]].pack('G')
+          s << pack_str(h[:file]) << pack_str(h[:method])
+        end
+        s
+      end
+
+      def unpack_history(data)
+        off = 4
+        (0...data[0, 4].unpack('N')[0]).map do
+          line, depth, call = data[off, 12].unpack('NNN')
+          time = data[off+12, 8].unpack('G')[0]
+          file, off = unpack_str(data, off + 20)
+          method, off = unpack_str(data, off)
+          {:event => call == 1 ? :call : :line, :file => file, :line => line,
+           :method => method, :depth => depth, :time => time}
+        end
+      end
+
+      def unpack_frame(data)
+        line = data[0, 4].unpack('N')[0]
+        off = 4
+        file, off = unpack_str(data, off)
+        method, off = unpack_str(data, off)
+        klass, off = unpack_str(data, off)
+        nargs = data[off, 4].unpack('N')[0]
+        off += 4
+        args = []
+        nargs.times do
+          name, off = unpack_str(data, off)
+          args << name
+        end
+        nlocals = data[off, 4].unpack('N')[0]
+        off += 4
+        locals = {}
+        nlocals.times do
+          name, off = unpack_str(data, off)
+          value, off = unpack_str(data, off)
+          locals[name] = Value.new(value)
+        end
+        Frame.new(file, line, method.empty? ? nil : method.to_sym,
+                  klass.empty? ? nil : klass, args, locals)
+      end
+    end
+
+    # A stand-in for Debugger::Context built from a core file. It
+    # answers the frame queries used by "where", "frame", "info locals"
+    # and "list"; everything that needs a live thread is unavailable.
+    class CoreContext
+      attr_accessor :pid, :time, :thnum, :program
+      attr_accessor :exception_class, :exception_message
+      attr_reader   :frames, :records
+      attr_writer   :recorded
+
+      def initialize
+        @frames  = []
+        @records = []
+        @recorded = []
+        @thnum   = 0
+      end
+
+      def dead?;       true  end
+      def ignored?;    false end
+      def suspended?;  false end
+      def tracing;     false end
+      def thread;      nil   end
+      def stop_reason; :'post-mortem' end
+
+      def stack_size
+        @frames.size
+      end
+
+      # What the flight recorder kept, as Context#history returns it.
+      def history(count=nil)
+        count ? @recorded.last(count) : @recorded
+      end
+
+      def frame_file(pos=0);    frame(pos).file   end
+      def frame_line(pos=0);    frame(pos).line   end
+      def frame_method(pos=0);  frame(pos).meth   end
+      def frame_class(pos=0);   frame(pos).klass  end
+      def frame_args(pos=0);    frame(pos).args   end
+      def frame_locals(pos=0);  frame(pos).locals end
+      def frame_args_info(pos=0); nil end
+      def frame_self(pos=0);    nil end
+      def frame_binding(pos=0); nil end
+      alias frame_id frame_method
+
+      private
+
+      def frame(pos)
+        unless pos >= 0 && pos < @frames.size
+          raise ArgumentError, "Invalid frame number #{pos}, stack (0...#{@frames.size - 1})"
+        end
+        @frames[pos]
+      end
+    end
+  end
+end
@@ -0,0 +1,49 @@
+module Debugger
+  # Reads the line trace written by Debugger.trace_file. The file
+  # starts with MAGIC followed by records of a one byte tag and 32-bit
+  # big-endian fields: 'F' gives a file name a number (id, length,
+  # name) and 'L' is a line traced (thread number, file id, line).
+  module TraceFile
+    MAGIC = "RDBTRAC1" unless defined?(MAGIC)
+
+    class << self
+      # Yield the thread number, file name and line of each line traced
+      # in +path+, in order. A record cut short at the end, as when the
+      # program was killed, is left out.
+      def each(path)
+        File.open(path, 'rb') do |f|
+          unless f.read(MAGIC.size) == MAGIC
+            raise IOError, "#{path} is not a ruby-debug trace file"
+          end
+          files = {}
+          while tag = f.read(1)
+            case tag
+            when 'F'
+              head = f.read(8)
+              break unless head && head.size == 8
+              id, len = head.unpack('NN')
+              name = f.read(len)
+              break unless name && name.size == len
+              files[id] = name
+            when 'L'
+              rec = f.read(12)
+              break unless rec && rec.size == 12
+              thnum, id, line = rec.unpack('NNN')
+              yield thnum, files[id], line
+            else
+              raise IOError, "#{path}: unknown trace record #{tag.inspect}"
+            end
+          end
+        end
+      end
+
+      # Print the trace in +path+ to +out+ as "set linetrace on" shows it.
+      def render(path, out=$stdout)
+        each(path) do |thnum, file, line|
+          out.print "Tracing(%d):%s:%s %s" %
+            [thnum, file, line, Debugger.line_at(file, line)]
+        end
+      end
+    end
+  end
+end
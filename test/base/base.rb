@@ -1,5 +1,6 @@
 #!/usr/bin/env ruby
 require 'test/unit'
+require 'tmpdir'
 
 # Some tests of Debugger module in C extension ruby_debug 
 class TestRubyDebug < Test::Unit::TestCase
@@ -52,5 +53,389 @@ class TestRubyDebug < Test::Unit::TestCase
     assert_equal(0, Debugger.breakpoints.size,
                  'There should no longer be any breakpoints set.')
   end
-end
 
+  # Yields the name of a log file Debugger.log_file is set to, and
+  # removes it afterwards.
+  def with_log_file
+    log = File.join(Dir.tmpdir, "rdebug-log-#{$$}")
+    Debugger.log_file = log
+    yield log
+  ensure
+    Debugger.log_file = nil
+    File.unlink(log) if log && File.exist?(log)
+  end
+
+  # Test logpoints write a message and don't stop
+  def test_logpoints
+    with_log_file do |log|
+      x = 5
+      lp = Debugger.add_logpoint(__FILE__, __LINE__ + 1, 'x={x} {{@a}} {@a}')
+      x += 1
+      assert_equal(:log, lp.action)
+      assert_equal(1, lp.hit_count)
+      assert_equal("#{__FILE__}:#{__LINE__ - 3}: x=5 {@a} nil\n", File.read(log))
+      assert_raises(ArgumentError) {Debugger.add_logpoint(__FILE__, 1, '{x')}
+      Debugger.remove_breakpoint(lp.id)
+    end
+  end
+
+  EXECUTABLE_LINE = __LINE__ + 3
+  def executable_target
+    # no code here
+    x = 1
+  end
+
+  # Test breakpoints on lines without code move to the next line with some
+  def test_executable_lines
+    lines = Debugger.executable_lines(__FILE__)
+    assert(lines.include?(EXECUTABLE_LINE))
+    assert(!lines.include?(EXECUTABLE_LINE - 1))
+    brk = Debugger.add_breakpoint(__FILE__, EXECUTABLE_LINE - 1)
+    assert_equal(EXECUTABLE_LINE, brk.pos)
+    Debugger.remove_breakpoint(brk.id)
+    assert_nil(Debugger.executable_lines('/no/such/file.rb'))
+  end
+
+  SNAPSHOT_LINE = __LINE__ + 2
+  def snapshot_target(x)
+    x + 1
+  end
+
+  # Test snapshot points record the stack and disable themselves
+  def test_snapshots
+    Debugger.clear_snapshots
+    sp = Debugger.add_snapshot(__FILE__, SNAPSHOT_LINE, :max_depth => 1,
+                               :count => 2)
+    [5, 6, 7].each {|x| snapshot_target(x)}
+    assert_equal(:snapshot, sp.action)
+    assert_equal(false, sp.enabled?)
+    snapshots = Debugger.snapshots
+    assert_equal(2, snapshots.size)
+    assert_equal(sp.id, snapshots[0][:breakpoint])
+    assert_equal(SNAPSHOT_LINE, snapshots[0][:line])
+    assert_equal("#0 #{__FILE__}:#{SNAPSHOT_LINE} in `snapshot_target'\n" +
+                 "    x = 5\n", snapshots[0][:text])
+    assert_match(/^    x = 6$/, snapshots[1][:text])
+    Debugger.remove_breakpoint(sp.id)
+
+    sp = Debugger.add_snapshot(__FILE__, SNAPSHOT_LINE, :max_bytes => 10)
+    snapshot_target(1)
+    assert_equal(true, Debugger.snapshots.last[:truncated])
+    assert_equal(10, Debugger.snapshots.last[:text].size)
+    Debugger.remove_breakpoint(sp.id)
+    Debugger.clear_snapshots
+    assert_equal([], Debugger.snapshots)
+  end
+
+  # Test the CPU governor samples an expensive conditional breakpoint
+  def test_cpu_budget
+    assert_nil(Debugger.cpu_budget)
+    Debugger.cpu_budget = 0.0001
+    Debugger.cpu_budget_window = 0.01
+    bp = Debugger.add_breakpoint(__FILE__, __LINE__ + 3,
+                                 '(1..2000).inject(:+) < 0')
+    deadline = Time.now + 10
+    while bp.sample < 2 && Time.now < deadline
+      x = 1
+    end
+    assert(bp.sample >= 2)
+    assert(Debugger.stats[:degraded].include?(
+      "breakpoint #{bp.id} sampled 1 hit in 2"))
+    assert(Debugger.stats[:hook_time] > 0)
+  ensure
+    Debugger.cpu_budget = nil
+    Debugger.cpu_budget_window = nil
+    Debugger.remove_breakpoint(bp.id) if bp
+  end
+
+  # Test simple conditions are recognized and checked without eval
+  def test_native_conditions
+    brk = Debugger.add_breakpoint(__FILE__, 1, 'count > 10')
+    assert(brk.native_condition?)
+    brk.expr = '@state == :failed'
+    assert(brk.native_condition?)
+    brk.expr = 'count.even?'
+    assert(!brk.native_condition?)
+    Debugger.remove_breakpoint(brk.id)
+
+    with_log_file do |log|
+      lp = Debugger.add_logpoint(__FILE__, __LINE__ + 3, '{x}')
+      lp.expr = 'x >= 2'
+      [1, 2, 3].each do |x|
+        x
+      end
+      assert_equal(["2", "3"], File.readlines(log).map {|l| l.split(': ').last.chomp})
+      Debugger.remove_breakpoint(lp.id)
+    end
+  end
+
+  # Test breakpoints restricted to some threads
+  def test_breakpoint_threads
+    with_log_file do |log|
+      thnum = Debugger.current_context.thnum
+      lp = Debugger.add_logpoint(__FILE__, __LINE__ + 5, 'hit')
+      assert_nil(lp.threads)
+      [[thnum + 100], [thnum + 100, thnum]].each do |threads|
+        lp.threads = threads
+        assert_equal(threads, lp.threads)
+        x = threads
+      end
+      assert_equal(1, File.readlines(log).size)
+      lp.threads = nil
+      assert_nil(lp.threads)
+      Debugger.remove_breakpoint(lp.id)
+    end
+  end
+
+  # Test a thread with debugging off doesn't reach the debugger
+  def test_thread_debugging
+    with_log_file do |log|
+      assert(Debugger.debugging_default)
+      lp = Debugger.add_logpoint(__FILE__, __LINE__ + 4, 'hit')
+      Debugger.debugging_default = false
+      Thread.new do
+        Thread.pass
+        x = 1
+      end.join
+      assert(!File.exist?(log) || File.read(log).empty?)
+      context = Debugger.current_context
+      assert(context.debugging?)
+      context.debugging = false
+      assert(!context.debugging?)
+      context.debugging = true
+      Debugger.remove_breakpoint(lp.id)
+    end
+  ensure
+    Debugger.debugging_default = true
+  end
+
+  # Test threads starting and exiting are reported to the listener
+  def test_thread_events
+    events = []
+    Debugger.on_thread_event { |event, thnum| events << [event, thnum] }
+    Thread.new { x = 1 }.join
+    Debugger.contexts
+    x = 1
+    start = events.assoc(:start)
+    assert(start)
+    assert(events.include?([:exit, start[1]]))
+  ensure
+    Debugger.on_thread_event
+  end
+
+  # Test the exception profiler counts raises by class and line
+  def test_exception_profile
+    assert(Debugger.exception_profile_start)
+    line = __LINE__ + 2
+    3.times do
+      begin raise ArgumentError; rescue ArgumentError; end
+    end
+    Debugger.exception_profile_stop
+    begin raise ArgumentError; rescue ArgumentError; end
+    profile = Debugger.exception_profile
+    assert_equal(1, profile.size)
+    assert_equal({:class => ArgumentError, :file => __FILE__, :line => line,
+                  :count => 3}, profile[0])
+    Debugger.exception_profile_start
+    assert_equal([], Debugger.exception_profile)
+  ensure
+    Debugger.exception_profile_stop
+  end
+
+  # Test breakpoints under a skip path are ignored
+  def test_skip_paths
+    with_log_file do |log|
+      assert_equal([], Debugger.skip_paths)
+      lp = Debugger.add_logpoint(__FILE__, __LINE__ + 3, 'hit')
+      [[File.dirname(__FILE__)], []].each do |paths|
+        Debugger.skip_paths = paths
+        x = paths
+      end
+      assert_equal([], Debugger.skip_paths)
+      assert_equal(1, File.readlines(log).size)
+      Debugger.remove_breakpoint(lp.id)
+    end
+  ensure
+    Debugger.skip_paths = nil
+  end
+
+  # Test the hook can be removed until the debugger is started again
+  def test_remove_hook
+    Debugger.remove_hook
+    assert(!Debugger.started?)
+    Debugger.start_
+    assert(Debugger.started?)
+  ensure
+    Debugger.start_
+  end
+
+  # Test Debugger.start turns the debugger back on when the exception
+  # profiler kept the hook installed
+  def test_start_after_remove_hook
+    require File.expand_path(File.join(File.dirname(__FILE__), '..', '..', 'lib',
+                                       'ruby-debug-base'))
+    with_log_file do |log|
+      Debugger.exception_profile_start
+      Debugger.remove_hook
+      assert(!Debugger.started?)
+      lp = Debugger.add_logpoint(__FILE__, __LINE__ + 3, 'hit')
+      [false, true].each do |start|
+        Debugger.start(:init => false) if start
+        x = start
+      end
+      assert(Debugger.started?)
+      assert_equal(1, lp.hit_count)
+      assert_equal(1, File.readlines(log).size)
+      Debugger.remove_breakpoint(lp.id)
+    end
+  ensure
+    Debugger.exception_profile_stop
+    Debugger.start_
+  end
+
+  # Test Debugger.start runs its block when the debugger was stopped
+  def test_start_block_after_stop
+    require File.expand_path(File.join(File.dirname(__FILE__), '..', '..', 'lib',
+                                       'ruby-debug-base'))
+    Debugger.stop
+    assert(!Debugger.started?)
+    ran = Debugger.start(:init => false) { Debugger.started? }
+    assert_equal(true, ran)
+    assert(!Debugger.started?)
+  ensure
+    Debugger.start_
+  end
+
+  # Test contexts report their memory use
+  def test_context_memsize
+    require 'objspace'
+    context = Debugger.current_context
+    assert(ObjectSpace.memsize_of(context) > 0)
+    assert_equal(2, Thread.new { Debugger.contexts.size }.value)
+    GC.start
+    assert_equal(1, Debugger.contexts.size)
+  end
+
+  # Test exceptions still unwind after the catcher entries are removed
+  # and put back
+  def test_catchall_restore
+    catchall = Debugger.catchall
+    Debugger.catchall = false
+    assert_equal(:rescued, (begin; 1/0; rescue ZeroDivisionError; :rescued; end))
+    Debugger.catchall = true
+    assert_equal(:rescued, (begin; 1/0; rescue ZeroDivisionError; :rescued; end))
+  ensure
+    Debugger.catchall = catchall
+  end
+
+  # Test the flight recorder keeps the last lines a thread ran
+  def test_flight_recorder
+    Debugger.flight_recorder = 4
+    assert_equal(4, Debugger.flight_recorder)
+    a = 1
+    a += 1
+    a += 1
+    a += 1
+    a += 1
+    Debugger.flight_recorder = nil
+    history = Debugger.current_context.history
+    assert_equal(4, history.size)
+    assert_equal(__FILE__, history[-1][:file])
+    assert_equal(2, Debugger.current_context.history(2).size)
+    assert(history.all?{|h| h[:event] == :line})
+  ensure
+    Debugger.flight_recorder = nil
+  end
+
+  # Test line tracing can be written to a file and read back
+  def test_trace_file
+    require File.expand_path(File.join(File.dirname(__FILE__), '..', '..', 'lib',
+                                       'ruby-debug-base', 'trace_file'))
+    path = File.join(Dir.tmpdir, "rdebug-trace-#{$$}")
+    Debugger.trace_file = path
+    assert_equal(path, Debugger.trace_file)
+    Debugger.tracing = true
+    line = __LINE__
+    Debugger.tracing = false
+    Debugger.trace_file = nil
+    lines = []
+    Debugger::TraceFile.each(path) { |thnum, file, n| lines << [thnum, file, n] }
+    assert(lines.include?([Debugger.current_context.thnum, __FILE__, line + 1]))
+  ensure
+    Debugger.tracing = false
+    Debugger.trace_file = nil
+    File.unlink(path) if path && File.exist?(path)
+  end
+
+  # Test trace filters can be set and read back
+  def test_trace_filter
+    assert_equal(nil, Debugger.trace_filter)
+    Debugger.trace_filter = {:include => ['*/app/*'], :methods => 'Foo#*',
+                             :max_depth => 2}
+    filter = Debugger.trace_filter
+    assert_equal(['*/app/*'], filter[:include])
+    assert_equal([], filter[:exclude])
+    assert_equal(['Foo#*'], filter[:methods])
+    assert_equal(2, filter[:max_depth])
+    assert_raise(TypeError) { Debugger.trace_filter = 'app' }
+    assert_equal(['*/app/*'], Debugger.trace_filter[:include])
+  ensure
+    Debugger.trace_filter = nil
+  end
+
+  # Test lines of excluded files aren't traced
+  def test_trace_filter_exclude
+    require File.expand_path(File.join(File.dirname(__FILE__), '..', '..', 'lib',
+                                       'ruby-debug-base', 'trace_file'))
+    path = File.join(Dir.tmpdir, "rdebug-trace-#{$$}")
+    Debugger.trace_filter = {:exclude => [__FILE__]}
+    Debugger.trace_file = path
+    Debugger.tracing = true
+    a = 1
+    Debugger.tracing = false
+    Debugger.trace_file = nil
+    files = []
+    Debugger::TraceFile.each(path) { |thnum, file, line| files << file }
+    assert(!files.include?(__FILE__))
+  ensure
+    Debugger.tracing = false
+    Debugger.trace_file = nil
+    Debugger.trace_filter = nil
+    File.unlink(path) if path && File.exist?(path)
+  end
+
+  def timeline_helper
+    :done
+  end
+
+  def test_timeline
+    path = File.join(Dir.tmpdir, "rdebug-timeline-#{$$}.json")
+    Debugger.timeline_start
+    timeline_helper
+    Debugger.timeline_stop
+    assert_equal(path, Debugger.timeline_dump(path))
+    json = File.read(path)
+    assert_match(/\A\{"traceEvents":\[/, json)
+    assert_match(/"name":"TestRubyDebug#timeline_helper","cat":"ruby","ph":"B"/, json)
+    assert_match(/"name":"TestRubyDebug#timeline_helper","cat":"ruby","ph":"E"/, json)
+  ensure
+    Debugger.timeline_stop
+    File.unlink(path) if path && File.exist?(path)
+  end
+
+  # Test threads with debugging off aren't recorded
+  def test_timeline_disabled_thread
+    path = File.join(Dir.tmpdir, "rdebug-timeline-#{$$}.json")
+    Debugger.timeline_start
+    Thread.new do
+      Debugger.current_context.debugging = false
+      timeline_helper
+    end.join
+    Debugger.timeline_stop
+    Debugger.timeline_dump(path)
+    assert_no_match(/timeline_helper/, File.read(path))
+  ensure
+    Debugger.timeline_stop
+    File.unlink(path) if path && File.exist?(path)
+  end
+end
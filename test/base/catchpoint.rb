@@ -17,6 +17,33 @@ class TestRubyDebugCatchpoint < Test::Unit::TestCase
     Debugger.add_catchpoint('RuntimeError')
     assert_equal(['RuntimeError', 'ZeroDivisionError'], 
                  Debugger.catchpoints.keys.sort)
+  ensure
+    Debugger.clear_catchpoints
+  end
+
+  def test_catchpoint_classes
+    assert_equal('ZeroDivisionError', Debugger.add_catchpoint('ZeroDivisionError'))
+    assert_equal('ZeroDivisionError', Debugger.catchpoint_for(ZeroDivisionError))
+    assert_nil(Debugger.catchpoint_for(ArgumentError))
+
+    # subclasses are caught and classes need not be named or defined yet
+    anonymous = Class.new(StandardError)
+    Debugger.add_catchpoint(anonymous)
+    assert_equal(Debugger.catchpoints.keys.last,
+                 Debugger.catchpoint_for(Class.new(anonymous)))
+    Debugger.add_catchpoint('TestRubyDebugCatchpoint::LaterError')
+    self.class.const_set(:LaterError, Class.new(ArgumentError))
+    assert_equal('TestRubyDebugCatchpoint::LaterError',
+                 Debugger.catchpoint_for(LaterError))
+
+    assert_equal(true, Debugger.remove_catchpoint('ZeroDivisionError'))
+    assert_equal(false, Debugger.remove_catchpoint('ZeroDivisionError'))
+    assert_nil(Debugger.catchpoint_for(ZeroDivisionError))
+    assert_equal(true, Debugger.remove_catchpoint(anonymous))
+    assert_nil(Debugger.catchpoint_for(Class.new(anonymous)))
+    assert_raise(TypeError) { Debugger.add_catchpoint(1) }
+  ensure
+    Debugger.clear_catchpoints
   end
 
 end
@@ -0,0 +1,65 @@
+#!/usr/bin/env ruby
+require 'test/unit'
+require 'tmpdir'
+
+# Test Debugger::CoreFile writing and reading.
+class TestCoreFile < Test::Unit::TestCase
+
+  require File.expand_path(File.join(File.dirname(__FILE__), '..', '..', 'lib',
+                                     'ruby-debug-base', 'core_file'))
+
+  # Just enough of Debugger::Context for CoreFile.write
+  class FakeContext
+    FRAMES = [
+      ['/tmp/gcd.rb', 6, :gcd, 'Object', ['a', 'b'], 
+       {'a' => 3, 'b' => 'x' * 1000}],
+      ['/tmp/gcd.rb', 18, nil, nil, [], {}]
+    ]
+    def thnum; 1 end
+    def stack_size; FRAMES.size end
+    def frame_file(i);   FRAMES[i][0] end
+    def frame_line(i);   FRAMES[i][1] end
+    def frame_method(i); FRAMES[i][2] end
+    def frame_class(i);  FRAMES[i][3] end
+    def frame_args(i);   FRAMES[i][4] end
+    def frame_locals(i); FRAMES[i][5] end
+    def history
+      [{:event => :call, :file => '/tmp/gcd.rb', :line => 4, :method => 'gcd',
+        :depth => 3, :time => 1.5}]
+    end
+  end
+
+  def test_round_trip
+    path = File.join(Dir.tmpdir, "rdebug-core-#{$$}")
+    Debugger::CoreFile.write(path, FakeContext.new, 
+                             ZeroDivisionError.new('divided by 0'))
+    core = Debugger::CoreFile.read(path)
+    assert_equal(true, core.dead?)
+    assert_equal(Process.pid, core.pid)
+    assert_equal('ZeroDivisionError', core.exception_class)
+    assert_equal('divided by 0', core.exception_message)
+    assert_equal(2, core.stack_size)
+    assert_equal('/tmp/gcd.rb', core.frame_file(0))
+    assert_equal(6, core.frame_line(0))
+    assert_equal(:gcd, core.frame_method(0))
+    assert_equal('Object', core.frame_class(0))
+    assert_equal(%w(a b), core.frame_args(0))
+    assert_equal('3', core.frame_locals(0)['a'].inspect)
+    assert_equal(Debugger::CoreFile::MAX_VALUE_SIZE,
+                 core.frame_locals(0)['b'].inspect.size)
+    assert_equal(nil, core.frame_method(1))
+    assert_equal({}, core.frame_locals(1))
+    assert_raise(ArgumentError) { core.frame_line(2) }
+    assert_equal(FakeContext.new.history, core.history)
+  ensure
+    File.unlink(path) if path && File.exist?(path)
+  end
+
+  def test_bad_file
+    path = File.join(Dir.tmpdir, "rdebug-notcore-#{$$}")
+    File.open(path, 'w') { |f| f.write("not a core file") }
+    assert_raise(IOError) { Debugger::CoreFile.read(path) }
+  ensure
+    File.unlink(path) if path && File.exist?(path)
+  end
+end
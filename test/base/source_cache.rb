@@ -0,0 +1,41 @@
+#!/usr/bin/env ruby
+require 'test/unit'
+require 'tmpdir'
+
+# Test Debugger::SourceCache line lookup and reloading.
+class TestSourceCache < Test::Unit::TestCase
+
+  $:.unshift File.join(File.dirname(__FILE__), '..', '..', 'ext')
+  require 'ruby_debug'
+  $:.shift
+
+  def setup
+    @path = File.join(Dir.tmpdir, "rdebug-source-#{$$}.rb")
+    File.open(@path, 'w') { |f| f.write("a = 1\n\nb = 2") }
+    Debugger::SourceCache.clear
+  end
+
+  def teardown
+    File.unlink(@path)
+  end
+
+  def test_lines
+    assert_equal(3, Debugger::SourceCache.size(@path))
+    assert_equal("a = 1\n", Debugger::SourceCache.line(@path, 1))
+    assert_equal("\n", Debugger::SourceCache.line(@path, 2))
+    assert_equal("b = 2", Debugger::SourceCache.line(@path, 3))
+    assert_equal(nil, Debugger::SourceCache.line(@path, 0))
+    assert_equal(nil, Debugger::SourceCache.line(@path, 4))
+    assert_equal(nil, Debugger::SourceCache.size(@path + '.missing'))
+  end
+
+  def test_reload
+    assert_equal("a = 1\n", Debugger::SourceCache.line(@path, 1))
+    File.open(@path, 'w') { |f| f.write("c = 3 # changed\n") }
+    File.utime(Time.now, Time.now + 10, @path)
+    assert_equal("a = 1\n", Debugger::SourceCache.line(@path, 1, true))
+    Debugger::SourceCache.expire
+    assert_equal("c = 3 # changed\n", Debugger::SourceCache.line(@path, 1, true))
+    assert_equal(1, Debugger::SourceCache.size(@path))
+  end
+end
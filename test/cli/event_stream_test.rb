@@ -0,0 +1,53 @@
+#!/usr/bin/env ruby
+require 'test/unit'
+require 'socket'
+
+# Test the buffering of the event stream sent to remote clients.
+class TestEventStream < Test::Unit::TestCase
+
+  require File.expand_path(File.join(File.dirname(__FILE__), '..', '..',
+                                     'cli', 'ruby-debug', 'event_stream'))
+  include Debugger
+
+  def read_event(io)
+    type, id, payload = FramedProtocol.read(io)
+    assert_equal(FramedProtocol::EVENT, type)
+    payload.split("\t")
+  end
+
+  def test_slow_client_drops_trace_first
+    a, b = UNIXSocket.pair
+    client = EventStream::Client.new(a, 3)
+    client.push(['trace', {:line => 1}, 0.0])
+    client.push(['stop', {:line => 2}, 0.0])
+    client.push(['trace', {:line => 3}, 0.0])
+    client.push(['exception', {:line => 4}, 0.0])
+    client.push(['trace', {:line => 5}, 0.0])
+    writer = Thread.new { client.send(:run) }
+    dropped = read_event(b)
+    assert_equal('dropped', dropped[0])
+    assert_equal('count=2', dropped[2])
+    assert_equal(['stop', 'time=0.000000', 'line=2'], read_event(b))
+    assert_equal(['exception', 'time=0.000000', 'line=4'], read_event(b))
+    assert_equal(['trace', 'time=0.000000', 'line=5'], read_event(b))
+    b.close
+    client.push(['stop', {}, 0.0])
+    writer.join(5)
+    assert_equal(true, client.closed?)
+  ensure
+    a.close rescue nil
+  end
+
+  def test_oldest_dropped_without_trace
+    a, b = UNIXSocket.pair
+    client = EventStream::Client.new(a, 1)
+    client.push(['stop', {:line => 1}, 0.0])
+    client.push(['stop', {:line => "2\t3"}, 0.0])
+    Thread.new { client.send(:run) }
+    assert_equal('dropped', read_event(b)[0])
+    assert_equal(['stop', 'time=0.000000', 'line=2 3'], read_event(b))
+  ensure
+    a.close rescue nil
+    b.close rescue nil
+  end
+end
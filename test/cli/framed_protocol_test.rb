@@ -0,0 +1,45 @@
+#!/usr/bin/env ruby
+require 'test/unit'
+require 'socket'
+require 'stringio'
+
+# Test the framing used by the remote interface's framed protocol.
+class TestFramedProtocol < Test::Unit::TestCase
+
+  require File.expand_path(File.join(File.dirname(__FILE__), '..', '..',
+                                     'cli', 'ruby-debug', 'protocol'))
+  include Debugger
+
+  def test_round_trip
+    io = StringIO.new
+    FramedProtocol.write(io, FramedProtocol::COMMAND, 1, 'break 10')
+    FramedProtocol.write(io, FramedProtocol::COMMAND, 2, '')
+    FramedProtocol.write(io, FramedProtocol::OUTPUT, 2, "caf\xc3\xa9\n")
+    io.rewind
+    assert_equal([FramedProtocol::COMMAND, 1, 'break 10'], 
+                 FramedProtocol.read(io))
+    assert_equal([FramedProtocol::COMMAND, 2, ''], FramedProtocol.read(io))
+    type, id, payload = FramedProtocol.read(io)
+    assert_equal(FramedProtocol::OUTPUT, type)
+    assert_equal(6, payload.bytesize)
+    assert_equal(nil, FramedProtocol.read(io))
+  end
+
+  def test_truncated_frame
+    io = StringIO.new(FramedProtocol.pack(FramedProtocol::OUTPUT, 1, 'abc')[0..-2])
+    assert_raise(IOError) { FramedProtocol.read(io) }
+  end
+
+  def test_handshake
+    a, b = UNIXSocket.pair
+    assert_equal(false, FramedProtocol.handshake?(a, 0.01))
+    b.write(FramedProtocol::MAGIC)
+    assert_equal(true, FramedProtocol.handshake?(a, 1))
+    b.write("list\n")
+    assert_equal(false, FramedProtocol.handshake?(a, 1))
+    assert_equal("list\n", a.gets)
+  ensure
+    a.close if a
+    b.close if b
+  end
+end